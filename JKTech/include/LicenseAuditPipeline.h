@@ -0,0 +1,94 @@
+#ifndef __LicenseAuditPipeline_H__
+#define __LicenseAuditPipeline_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "LicenseTimeStamp.h"
+#include "LicensePairScanner.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The output format of the audit results.
+ *
+ * @AUDIT_CSV: one comma-separated line per license pair, after a header line
+ * @AUDIT_JSON: one JSON object per line per license pair (i.e., JSON lines), so that the results can be streamed
+ */
+enum AuditOutputFormat {
+  AUDIT_CSV,
+  AUDIT_JSON
+};
+
+/**
+ * @brief
+ * The statistics of an audit run.
+ */
+struct LicenseAuditStatistics {
+  unsigned long DirectoriesScanned;
+  unsigned long FilesScanned;
+  unsigned long PairsVerified;
+  unsigned long ValidLicenses;
+  unsigned long ExpiredLicenses;
+  unsigned long FailedLicenses;
+  unsigned long OrphanCheckSumFiles;
+  double Seconds;
+};
+
+/**
+ * @brief
+ * An audit pipeline to discover and verify all license pairs under the given directory trees.
+ *
+ * The directory trees are walked in parallel: each worker thread takes a directory from a shared stack and reads its license pairs in batches (see LicensePairScanner).
+ * Each license pair is verified (i.e., decrypted, tamper-checked and checked for expiry), and the result is streamed out as CSV or JSON lines.
+ *
+ * Neither the directory entries nor the results are accumulated, so the memory usage is bounded by the number of pending directories, not by the number of license files.
+ */
+class LicenseAuditPipeline
+{
+public:
+
+  LicenseAuditPipeline(double LicenseDuration, int ThreadCount, string EncryptedSuffix = DEFAULT_ENCRYPTED_SUFFIX, string CheckSumSuffix = DEFAULT_CHECKSUM_SUFFIX);
+  void SetRevocationList(const LicenseRevocationList *RevocationList);
+  void SetPrimePool(const LicensePrimePool *PrimePool);
+  OperationState Run(const vector<string> &RootDirectories, ostream &Output, AuditOutputFormat Format);
+  LicenseAuditStatistics GetStatistics() const;
+
+private:
+  double LicenseDurationInDays;
+  int ThreadCount;
+  string EncryptedSuffix;
+  string CheckSumSuffix;
+  const LicenseRevocationList *RevocationList;
+  const LicensePrimePool *PrimePool;
+
+  vector<string> PendingDirectories;
+  int ActiveWorkers;
+  mutex DirectoryMutex;
+  condition_variable DirectoryCondition;
+
+  ostream *Output;
+  AuditOutputFormat Format;
+  mutex OutputMutex;
+
+  atomic<unsigned long> DirectoriesScanned;
+  atomic<unsigned long> FilesScanned;
+  atomic<unsigned long> PairsVerified;
+  atomic<unsigned long> ValidLicenses;
+  atomic<unsigned long> ExpiredLicenses;
+  atomic<unsigned long> FailedLicenses;
+  atomic<unsigned long> CheckSumFiles;
+  atomic<unsigned long> MatchedCheckSumFiles;
+  double Seconds;
+
+  void RunWorker();
+  void ScanDirectory(LicensePairScanner &Scanner, const string &Directory, string &Results);
+  void VerifyPair(const string &EncryptionFileName, const string &CheckSumFileName, string &Results);
+  void FlushResults(string &Results, bool Force);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __LicenseConcurrentVerifier_H__
+#define __LicenseConcurrentVerifier_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ctime>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The maximal number of reader threads which can hold a hazard pointer at the same time.
+ * The reader threads beyond this limit are still served, but through the verifier lock.
+ */
+const int MAX_HAZARD_THREADS = 256;
+
+/**
+ * @brief
+ * An immutable snapshot of a verified license, published by the verifier to the reader threads.
+ *
+ * @State: The operational state of the last verification (LICENSE_REVOKED for a revoked license). The license is treated as expired if it is not SUCCESS.
+ * @StartTime: The license start time
+ * @Deadline: The license expiry deadline (i.e., the start time plus the license duration)
+ * @Generation: The number of snapshots published before this one
+ */
+struct VerifiedLicenseSnapshot {
+  OperationState State;
+  time_t StartTime;
+  time_t Deadline;
+  unsigned long Generation;
+};
+
+/**
+ * @brief
+ * A concurrent mode of the license timestamp operation.
+ *
+ * A single verifier (i.e., the thread calling Refresh) decrypts and checks the timestamp file, and publishes an immutable snapshot through an atomic pointer.
+ * Any number of reader threads can check the expiry against the latest snapshot without any lock.
+ *
+ * The replaced snapshots are reclaimed with hazard pointers: each reader thread announces the snapshot it is reading,
+ * and the verifier only deletes the replaced snapshots which are not announced by any reader thread.
+ */
+class LicenseConcurrentVerifier
+{
+public:
+
+  LicenseConcurrentVerifier(string encryptionFileName, string CheckSumFileName, double LicenseDuration, const LicensePrimePool *PrimePool = nullptr);
+  ~LicenseConcurrentVerifier();
+  OperationState Refresh(const LicenseRevocationList *RevocationList = nullptr);
+  bool IsTimeStampExpired() const;
+  bool IsTimeStampExpired(time_t NowTime) const;
+  bool GetSnapshot(VerifiedLicenseSnapshot &Snapshot) const;
+
+private:
+  LicenseConcurrentVerifier(const LicenseConcurrentVerifier &);
+  LicenseConcurrentVerifier &operator=(const LicenseConcurrentVerifier &);
+
+  LicenseTimeStampOperation Operation;
+  atomic<const VerifiedLicenseSnapshot*> Current;
+  mutable mutex VerifierMutex;
+  vector<const VerifiedLicenseSnapshot*> Retired;
+  unsigned long Generation;
+  void Reclaim();
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __LicenseDeadlineIndex_H__
+#define __LicenseDeadlineIndex_H__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The number of entries of the sorted run between two keys of the sparse index.
+ */
+const int SPARSE_INDEX_INTERVAL = 128;
+
+/**
+ * @brief
+ * An entry of the deadline index, i.e., a license identity with its expiry deadline. The entries are sorted by (Deadline, Id).
+ */
+struct DeadlineIndexEntry {
+  int64_t Deadline;
+  license_id Id;
+};
+
+/**
+ * @brief
+ * A persistent secondary index from the expiry deadlines to the license identities, to find all licenses expiring within a time range without decrypting any license file.
+ *
+ * The index is a sorted run of (deadline, id) entries in the index file, which is memory-mapped, with a sparse index (one deadline every SPARSE_INDEX_INTERVAL entries) kept in memory.
+ * A range query binary-searches the sparse index, then scans the run from the first entry in range.
+ *
+ * The licenses issued, renewed or removed since the run was written are appended to a journal file ("<index file>.journal") and kept in memory,
+ * so an update never rewrites the run. The journal is merged into a new run by Compact, which shall be called when the journal grows large.
+ * The journal file is locked (flock), so several processes may update and compact the same index.
+ */
+class LicenseDeadlineIndex
+{
+public:
+
+  LicenseDeadlineIndex();
+  ~LicenseDeadlineIndex();
+  OperationState Open(const string &IndexFileName);
+  OperationState UpsertLicense(license_id Id, time_t Deadline);
+  OperationState RemoveLicense(license_id Id);
+  OperationState IndexLicense(LicenseTimeStampOperation &Operation);
+  OperationState QueryRange(time_t From, time_t To, vector<license_id> &Ids) const;
+  OperationState QueryExpiringWithin(double Days, vector<license_id> &Ids) const;
+  OperationState Compact();
+  OperationState Sync();
+  size_t GetRunSize() const;
+  size_t GetJournalSize() const;
+
+private:
+  LicenseDeadlineIndex(const LicenseDeadlineIndex &);
+  LicenseDeadlineIndex &operator=(const LicenseDeadlineIndex &);
+
+  string IndexFileName;
+  string JournalFileName;
+  int JournalDescriptor;
+
+  void *Mapping;
+  size_t MappingLength;
+  const DeadlineIndexEntry *Run;
+  size_t RunSize;
+  dev_t RunDevice;
+  ino_t RunInode;
+  vector<int64_t> SparseIndex;
+
+  unordered_map<license_id, int64_t> Overrides;
+  set< pair<int64_t, license_id> > PendingEntries;
+  size_t JournalSize;
+
+  OperationState LoadRun();
+  OperationState ReplayJournal();
+  OperationState AppendJournal(license_id Id, int64_t Deadline);
+  OperationState WriteRun();
+  bool IsCurrent() const;
+  void ApplyUpdate(license_id Id, int64_t Deadline);
+  void UnloadRun();
+};
+
+#endif
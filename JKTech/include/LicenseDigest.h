@@ -0,0 +1,55 @@
+#ifndef __LicenseDigest_H__
+#define __LicenseDigest_H__
+
+#include <string>
+#include <array>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The length of a digest (in bytes) produced by the SHA-256 hash function.
+ *
+ */
+const int DIGEST_SIZE = 32;
+
+typedef array<uint8_t, DIGEST_SIZE> license_digest;
+
+/**
+ * @brief
+ * A self-contained SHA-256 hash function, so that the integrity checks in this library do not depend on any third-party crypto library.
+ *
+ * @param Data
+ * The data to be hashed
+ * @param Length
+ * The length of the data (in bytes)
+ * @param Prefix
+ * A single byte hashed in front of the data. It is used for the domain separation (e.g., the leaf and the internal nodes in a Merkle tree). A negative value means no prefix.
+ * @return license_digest
+ * The SHA-256 digest
+ */
+license_digest ComputeDigest(const void *Data, size_t Length, int Prefix = -1);
+
+/**
+ * @brief
+ * A function to hash the concatenation of two digests with a prefix byte, i.e., H(Prefix || Left || Right).
+ */
+license_digest ComputeDigest(const license_digest &Left, const license_digest &Right, int Prefix);
+
+/**
+ * @brief
+ * A function to hash the concatenation of several buffers (each given by its data and length), without copying them into one.
+ */
+license_digest ComputeDigest(const vector< pair<const void *, size_t> > &Parts);
+
+/**
+ * @brief
+ * A function to convert a digest into its hexadecimal string, and vice versa.
+ */
+string DigestToString(const license_digest &Digest);
+bool StringToDigest(const string &Hex, license_digest &Digest);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __LicenseMerkleTree_H__
+#define __LicenseMerkleTree_H__
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include "LicenseTimeStamp.h"
+#include "LicenseDigest.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The maximal number of threads used to build or verify the Merkle tree.
+ */
+const int MAX_MERKLE_THREADS = 64;
+
+/**
+ * @brief
+ * A Merkle tree (i.e., a hash tree) over all license records in a license store.
+ *
+ * Each leaf is the hash of one license record (i.e., the content of its encrypted timestamp file and its checksum file).
+ * Each internal node is the hash of its two children. A node without a right sibling is promoted to the upper level as it is.
+ *
+ * The leaf hashes are kept in an index file, while the root hash is kept in a separate root file, in the same spirit as the split between the encrypted timestamp file and the checksum file:
+ * the attacker has to tamper with the records, the index file and the root file consistently in order to circumvent the integrity check.
+ *
+ * After a record was updated, only the nodes on the path from its leaf to the root are rehashed (i.e., O(log n)).
+ * A single record can be proven against the root with a proof of O(log n) hashes.
+ */
+class LicenseMerkleTree
+{
+public:
+
+  LicenseMerkleTree();
+  OperationState BuildFromFiles(const license_file_list &Files, int ThreadCount);
+  OperationState VerifyFiles(const license_file_list &Files, vector<size_t> &TamperedRecords, int ThreadCount);
+  size_t AppendRecord(const string &Record);
+  OperationState UpdateRecord(size_t Index, const string &Record);
+  OperationState GetProof(size_t Index, vector<license_digest> &Proof) const;
+  static bool VerifyProof(const string &Record, size_t Index, size_t RecordCount, const vector<license_digest> &Proof, const license_digest &Root);
+  static OperationState ReadLicenseRecord(const string &EncryptionFileName, const string &CheckSumFileName, string &Record);
+  license_digest GetRoot() const;
+  size_t GetRecordCount() const;
+  OperationState WriteIndexFile(const string &IndexFileName) const;
+  OperationState LoadIndexFile(const string &IndexFileName, int ThreadCount);
+  OperationState WriteRootFile(const string &RootFileName) const;
+  OperationState VerifyRootFile(const string &RootFileName) const;
+
+private:
+  vector< vector<license_digest> > Levels;
+  void ResizeLevels(size_t RecordCount);
+  void BuildLevels(int ThreadCount);
+  void BuildSubtree(size_t FirstLeaf, size_t LastLeaf, size_t Span);
+  void BuildTopLevels(size_t Span);
+  license_digest ComputeNode(size_t Level, size_t Index) const;
+  void RehashPath(size_t Index);
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __LicenseMigrationEngine_H__
+#define __LicenseMigrationEngine_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <unordered_set>
+#include "LicenseTimeStamp.h"
+#include "LicensePairScanner.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The default capacity of each queue between two stages of the migration, i.e., the number of licenses which can be in flight between them.
+ */
+const size_t DEFAULT_MIGRATION_QUEUE_CAPACITY = 1024;
+
+/**
+ * @brief
+ * A lookup of the key schedule a license is encrypted with, from its encrypted timestamp file and its identity (see LicenseTimeStampOperation::GetLicenseId).
+ * An empty key schedule is the default one. A license which cannot be looked up (i.e., the lookup does not return SUCCESS) fails to be migrated.
+ */
+typedef function<OperationState(const string &EncryptionFileName, license_id Id, prime_list &KeySchedule)> key_schedule_lookup;
+
+/**
+ * @brief
+ * A bounded blocking queue between two stages of the migration. A producer blocks while the queue is full, so a slow stage throttles the stages before it
+ * instead of letting the licenses pile up in memory.
+ */
+template <typename T>
+class MigrationQueue
+{
+public:
+
+  MigrationQueue(size_t Capacity) : Capacity(Capacity), Closed(false) {
+  }
+
+  /**
+   * @brief
+   * A method to push an item, which blocks while the queue is full.
+   *
+   * @return bool
+   * false if the queue has been closed
+   */
+  bool Push(T &&Item) {
+    unique_lock<mutex> lock(QueueMutex);
+    NotFull.wait(lock, [this] { return Items.size() < Capacity || Closed; });
+    if (Closed) {
+      return false;
+    }
+    Items.push_back(move(Item));
+    NotEmpty.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief
+   * A method to pop an item, which blocks while the queue is empty.
+   *
+   * @return bool
+   * false if the queue has been closed and drained
+   */
+  bool Pop(T &Item) {
+    unique_lock<mutex> lock(QueueMutex);
+    NotEmpty.wait(lock, [this] { return !Items.empty() || Closed; });
+    if (Items.empty()) {
+      return false;
+    }
+    Item = move(Items.front());
+    Items.pop_front();
+    NotFull.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief
+   * A method to close the queue once all of its producers have finished. The items left in the queue can still be popped.
+   */
+  void Close() {
+    lock_guard<mutex> lock(QueueMutex);
+    Closed = true;
+    NotEmpty.notify_all();
+    NotFull.notify_all();
+  }
+
+  size_t GetSize() {
+    lock_guard<mutex> lock(QueueMutex);
+    return Items.size();
+  }
+
+private:
+  size_t Capacity;
+  bool Closed;
+  deque<T> Items;
+  mutex QueueMutex;
+  condition_variable NotEmpty;
+  condition_variable NotFull;
+};
+
+/**
+ * @brief
+ * A license in flight through the migration stages.
+ */
+struct MigrationItem {
+  string EncryptionFileName;
+  string CheckSumFileName;
+  string TimeStamp;
+  license_id Serial;
+  vector<uint32_t> KeyIndexes;
+  double EncryptedOut[SIZE];
+  size_t Length;
+  string CheckSum;
+};
+
+/**
+ * @brief
+ * The statistics of a migration run.
+ */
+struct LicenseMigrationStatistics {
+  unsigned long PairsDiscovered;
+  unsigned long PairsMigrated;
+  unsigned long PairsSkipped;
+  unsigned long PairsResumed;
+  unsigned long PairsFailed;
+  double Seconds;
+  long PeakResidentKiloBytes;
+};
+
+/**
+ * @brief
+ * A migration engine to re-encrypt all license pairs under the given directory trees, e.g., when the licenses move to a new key schedule.
+ *
+ * The license pairs stream through a pipeline of stages: discover -> decrypt (with the source key schedule) -> re-encrypt (with the target key schedule) -> durable write,
+ * with a bounded queue between two stages and a pool of worker threads for each of the decrypt, re-encrypt and write stages.
+ *
+ * The source key schedule of each license is looked up from its file and identity, so the licenses need not share one. A license whose key schedule was drawn
+ * from a prime pool is decrypted with the schedule of its stored indexes in the source pool instead. With a target pool, each license is re-encrypted with
+ * a key schedule drawn for it, as when it is issued (see LicenseTimeStampOperation::EncryptTimeStamp).
+ *
+ * A license pair is replaced through staged files (see LicenseTimeStampOperation::StageTimeStampFile and CommitTimeStampFile). Each replacement is recorded in a checkpoint journal,
+ * before the staged files replace the original ones ("P <file>") and after ("D <file>"). A license cannot be decrypted twice with the source key schedule,
+ * so an interrupted migration is resumed from the journal: the licenses done are skipped, and the replacements pending are completed from their staged files.
+ */
+class LicenseMigrationEngine
+{
+public:
+
+  LicenseMigrationEngine(const prime_list &SourceSchedule, const prime_list &TargetSchedule, int ThreadCount, size_t QueueCapacity = DEFAULT_MIGRATION_QUEUE_CAPACITY,
+                         string EncryptedSuffix = DEFAULT_ENCRYPTED_SUFFIX, string CheckSumSuffix = DEFAULT_CHECKSUM_SUFFIX);
+  LicenseMigrationEngine(const key_schedule_lookup &SourceLookup, const LicensePrimePool *SourcePool, const prime_list &TargetSchedule, const LicensePrimePool *TargetPool,
+                         int ThreadCount, size_t QueueCapacity = DEFAULT_MIGRATION_QUEUE_CAPACITY,
+                         string EncryptedSuffix = DEFAULT_ENCRYPTED_SUFFIX, string CheckSumSuffix = DEFAULT_CHECKSUM_SUFFIX);
+  OperationState Run(const vector<string> &RootDirectories, const string &JournalFileName, ostream *Progress = nullptr);
+  LicenseMigrationStatistics GetStatistics() const;
+
+private:
+  key_schedule_lookup SourceLookup;
+  const LicensePrimePool *SourcePool;
+  prime_list TargetSchedule;
+  const LicensePrimePool *TargetPool;
+  int ThreadCount;
+  string EncryptedSuffix;
+  string CheckSumSuffix;
+
+  MigrationQueue<MigrationItem> DiscoveredQueue;
+  MigrationQueue<MigrationItem> DecryptedQueue;
+  MigrationQueue<MigrationItem> EncryptedQueue;
+  atomic<int> ActiveDecryptWorkers;
+  atomic<int> ActiveEncryptWorkers;
+
+  unordered_set<uint64_t> CompletedFiles;
+  int JournalDescriptor;
+  mutex JournalMutex;
+
+  atomic<unsigned long> PairsDiscovered;
+  atomic<unsigned long> PairsMigrated;
+  atomic<unsigned long> PairsSkipped;
+  atomic<unsigned long> PairsResumed;
+  atomic<unsigned long> PairsFailed;
+  double Seconds;
+
+  OperationState ResumeJournal(const string &JournalFileName);
+  static uint64_t GetFileKey(const string &EncryptionFileName);
+  OperationState AppendJournal(char Record, const string &EncryptionFileName, bool Durable);
+  void DiscoverPairs(const vector<string> &RootDirectories);
+  void RunDecryptWorker();
+  void RunEncryptWorker();
+  void RunWriteWorker();
+  void ReportProgress(ostream &Progress, double Elapsed);
+};
+
+#endif
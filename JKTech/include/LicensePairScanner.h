@@ -0,0 +1,85 @@
+#ifndef __LicensePairScanner_H__
+#define __LicensePairScanner_H__
+
+#include <string>
+#include <vector>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The default names of the encrypted timestamp file and the checksum file. A license pair is an encrypted timestamp file "<prefix>Encrypted.txt" with a checksum file "<prefix>checksum.txt" in the same directory.
+ */
+const string DEFAULT_ENCRYPTED_SUFFIX = "Encrypted.txt";
+const string DEFAULT_CHECKSUM_SUFFIX = "checksum.txt";
+
+/**
+ * @brief
+ * The size of the buffer (in bytes) for each getdents64 call, i.e., how many directory entries are read (and their checksum files looked up) in one batch.
+ */
+const int DIRECTORY_BATCH_SIZE = 64 * 1024;
+
+/**
+ * @brief
+ * A license pair found in a directory.
+ *
+ * @EncryptionFileName: the encrypted timestamp file "<directory>/<prefix><encrypted suffix>"
+ * @CheckSumFileName: its checksum file "<directory>/<prefix><checksum suffix>"
+ * @Paired: whether the checksum file exists (as a regular file)
+ */
+struct LicensePair {
+  string EncryptionFileName;
+  string CheckSumFileName;
+  bool Paired;
+};
+
+/**
+ * @brief
+ * The directory entries of a batch (see LicensePairScanner::ReadBatch).
+ *
+ * @Subdirectories: the subdirectories of the batch, to be scanned in turn
+ * @Pairs: the license pairs of the batch, i.e., one for each encrypted timestamp file
+ * @RegularFiles: the number of regular files of the batch
+ * @CheckSumFiles: the number of checksum files of the batch (paired or not)
+ */
+struct LicensePairBatch {
+  vector<string> Subdirectories;
+  vector<LicensePair> Pairs;
+  unsigned long RegularFiles;
+  unsigned long CheckSumFiles;
+};
+
+/**
+ * @brief
+ * A scanner of the license pairs in a directory, shared by the audit pipeline and the migration engine.
+ *
+ * The entries of the directory are read in batches with getdents64, so there is no stat call for the entries which are not license files
+ * (except on the file systems without the entry type in their directory entries). The checksum file of each encrypted timestamp file of a batch
+ * is looked up with fstatat relative to the open directory. A scanner walks a single directory; the walk of the directory trees is up to the caller.
+ */
+class LicensePairScanner
+{
+public:
+
+  LicensePairScanner(const string &EncryptedSuffix = DEFAULT_ENCRYPTED_SUFFIX, const string &CheckSumSuffix = DEFAULT_CHECKSUM_SUFFIX);
+  ~LicensePairScanner();
+  OperationState Open(const string &Directory);
+  bool ReadBatch(LicensePairBatch &Batch);
+  void Close();
+  bool IsEncryptionFileName(const string &FileName) const;
+  string GetCheckSumFileName(const string &EncryptionFileName) const;
+
+private:
+  // a scanner owns an open directory, so it cannot be copied.
+  LicensePairScanner(const LicensePairScanner &);
+  LicensePairScanner &operator=(const LicensePairScanner &);
+
+  string EncryptedSuffix;
+  string CheckSumSuffix;
+  int DirectoryDescriptor;
+  string Prefix;
+  vector<char> Buffer;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __LicensePrimePool_H__
+#define __LicensePrimePool_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The number of prime pairs in a key schedule, i.e., one pair for each byte of the timestamp string.
+ */
+const int KEY_SCHEDULE_LENGTH = SIZE - 1;
+
+/**
+ * @brief
+ * The number of odd candidates sieved at a time when the prime pool is built.
+ */
+const int SIEVE_WINDOW = 1 << 16;
+
+/**
+ * @brief
+ * A pool of random primes for the per-license key randomization.
+ *
+ * The pool is built offline (see BuildPrimePoolFile): random windows of odd numbers are sieved with the small primes, and the survivors are confirmed with a deterministic Miller-Rabin test.
+ * The pool file is a compact table of 64-bit primes, which is memory-mapped when loaded. When a license is issued, its key schedule is drawn from the pool
+ * by random indexes, so no prime is generated on the fly. The indexes are kept in the checksum file of the license (covered by the checksum), and any
+ * LicenseTimeStampOperation given the same pool looks up the key schedule from them when the license is inspected.
+ *
+ * NOTE: the key schedule only varies the public exponent of each byte (see LicenseTimeStampOperation::GetPublicKey), which is a small odd number whatever the size of the primes,
+ * so the pool does not add entropy to the encrypted timestamp.
+ *
+ * Once loaded, the pool is read only, so key schedules can be drawn from any number of threads at the same time.
+ */
+class LicensePrimePool
+{
+public:
+
+  LicensePrimePool();
+  ~LicensePrimePool();
+  OperationState LoadPrimePoolFile(const string &PrimePoolFileName);
+  OperationState DrawKeySchedule(vector<uint32_t> &Indexes, prime_list &KeySchedule) const;
+  OperationState LookupKeySchedule(const vector<uint32_t> &Indexes, prime_list &KeySchedule) const;
+  size_t GetPrimeCount() const;
+  int GetPrimeBits() const;
+  static OperationState BuildPrimePoolFile(const string &PrimePoolFileName, size_t PrimeCount, int PrimeBits);
+  static bool IsPrime(uint64_t n);
+
+private:
+  LicensePrimePool(const LicensePrimePool &);
+  LicensePrimePool &operator=(const LicensePrimePool &);
+
+  void *Mapping;
+  size_t MappingLength;
+  const uint64_t *Primes;
+  size_t PrimeCount;
+  int PrimeBits;
+  void Unload();
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __LicenseRegistry_H__
+#define __LicenseRegistry_H__
+
+#include <ctime>
+#include <stdint.h>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The number of bits of the expiry deadline (in seconds since the epoch) in a registry record. The remaining bits of the 64-bit word are the status bits.
+ */
+const int REGISTRY_DEADLINE_BITS = 40;
+
+/**
+ * @brief
+ * The status bits of a license in the registry.
+ *
+ * @REGISTRY_STATUS_VERIFIED: The license timestamp has been decrypted and tamper-checked, i.e., the deadline is valid
+ * @REGISTRY_STATUS_REVOKED: The license has been revoked before its expiry
+ * @REGISTRY_STATUS_TAMPERED: The license timestamp file has been tampered with, or could not be read
+ */
+enum LicenseRegistryStatus {
+  REGISTRY_STATUS_VERIFIED = 1 << 0,
+  REGISTRY_STATUS_REVOKED = 1 << 1,
+  REGISTRY_STATUS_TAMPERED = 1 << 2
+};
+
+/**
+ * @brief
+ * A record of the registry, i.e., a license identity with its expiry deadline and status bits packed into 16 bytes, so that four records share a cache line.
+ */
+struct RegistryRecord {
+  license_id Id;
+  uint64_t DeadlineAndStatus;
+};
+
+/**
+ * @brief
+ * A compact in-memory registry of verified licenses, to check the expiry of a very large number of licenses (e.g., 10^8) without keeping a LicenseTimeStampOperation for each of them.
+ *
+ * The records are kept in an open-addressing hash table with linear probing, so a lookup reads one cache line in most cases.
+ * The table is allocated from an arena of huge pages (MAP_HUGETLB), or of transparent huge pages if none is reserved, to avoid a TLB miss on most lookups as well.
+ *
+ * The lookups are read only, so they can be made from any number of threads at the same time. The updates shall be serialized by the caller, and not be made concurrently with the lookups.
+ */
+class LicenseRegistry
+{
+public:
+
+  LicenseRegistry(size_t ExpectedLicenses = 0);
+  ~LicenseRegistry();
+  OperationState Reserve(size_t ExpectedLicenses);
+  OperationState Insert(license_id Id, time_t Deadline, uint32_t Status);
+  OperationState RegisterLicense(LicenseTimeStampOperation &Operation, const LicenseRevocationList *RevocationList = nullptr);
+  OperationState RecordVerification(license_id Id, time_t Deadline, uint32_t Status, bool RevocationChecked);
+  bool Remove(license_id Id);
+  bool Lookup(license_id Id, time_t &Deadline, uint32_t &Status) const;
+  bool IsExpired(license_id Id, time_t Now) const;
+  void IsExpired(const license_id *Ids, size_t Count, time_t Now, bool *Expired) const;
+  size_t GetCount() const;
+  size_t GetCapacity() const;
+  size_t GetMemoryBytes() const;
+  double GetBytesPerLicense() const;
+  bool IsHugePageBacked() const;
+
+private:
+  LicenseRegistry(const LicenseRegistry &);
+  LicenseRegistry &operator=(const LicenseRegistry &);
+
+  RegistryRecord *Slots;
+  size_t Capacity;
+  size_t Count;
+  size_t ArenaLength;
+  bool HugePages;
+  bool HasZeroId;
+  RegistryRecord ZeroRecord;
+
+  OperationState Rehash(size_t NewCapacity);
+  const RegistryRecord *Find(license_id Id) const;
+  size_t GetHomeSlot(license_id Id) const;
+  bool IsRecordExpired(const RegistryRecord *Record, time_t Now) const;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __LicenseRevocationList_H__
+#define __LicenseRevocationList_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "LicenseTimeStamp.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The number of bits in the Bloom filter for each revoked license. With 7 bits set in a single cache line per license, it gives a false positive rate of about 1%.
+ */
+const int BLOOM_BITS_PER_LICENSE = 10;
+
+/**
+ * @brief
+ * The number of bits set in the Bloom filter for each revoked license.
+ */
+const int BLOOM_HASH_COUNT = 7;
+
+/**
+ * @brief
+ * A block of the Bloom filter, which is exactly one cache line (512 bits). All bits of a license are set in the same block.
+ */
+struct alignas(64) BloomBlock {
+  uint64_t Words[8];
+};
+
+/**
+ * @brief
+ * The list of the revoked licenses.
+ *
+ * The revocation file holds the sorted identities of the revoked licenses. It is memory-mapped, so a large revocation list is neither copied nor parsed when it is loaded.
+ * A blocked Bloom filter is built in front of it: a license which is not revoked is rejected by a single cache line of the filter in most cases,
+ * and only the licenses that pass the filter are looked up in the revocation file with a binary search.
+ *
+ * Once loaded, the list is read only, so it can be checked from any number of threads at the same time.
+ */
+class LicenseRevocationList
+{
+public:
+
+  LicenseRevocationList();
+  ~LicenseRevocationList();
+  OperationState LoadRevocationFile(const string &RevocationFileName);
+  bool IsRevoked(license_id Id) const;
+  size_t GetRevokedCount() const;
+  size_t GetFilterSize() const;
+  static OperationState WriteRevocationFile(const string &RevocationFileName, vector<license_id> RevokedIds);
+
+private:
+  LicenseRevocationList(const LicenseRevocationList &);
+  LicenseRevocationList &operator=(const LicenseRevocationList &);
+
+  void *Mapping;
+  size_t MappingLength;
+  const license_id *RevokedIds;
+  size_t RevokedCount;
+  BloomBlock *Filter;
+  size_t FilterBlocks;
+  void Unload();
+  bool MayBeRevoked(license_id Id) const;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __LicenseStateSnapshot_H__
+#define __LicenseStateSnapshot_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "LicenseTimeStamp.h"
+#include "LicenseRegistry.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * The identity of a license file when its license was verified. A file whose identity has not changed since then does not need to be verified again.
+ * The change time cannot be set by the user (unlike the modification time), so a file which was rewritten and touched back is still detected.
+ */
+struct SnapshotFileIdentity {
+  uint64_t Device;
+  uint64_t Inode;
+  uint64_t Size;
+  int64_t ModificationTime;
+  int64_t ChangeTime;
+};
+
+/**
+ * @brief
+ * The verified state of a license, as kept in the snapshot file (followed by the file names in the string table of the snapshot file).
+ *
+ * @Files: the identities of the encrypted timestamp file and the checksum file
+ * @ContentHash: the first 8 bytes of the SHA-256 digest of both files, to accept a copied or restored license without decrypting it
+ * @StartTime: the license start time. The deadline is computed from it with the license duration when the snapshot is loaded.
+ * @Status: the status bits of the license (see LicenseRegistryStatus)
+ */
+struct SnapshotRecord {
+  SnapshotFileIdentity Files[2];
+  uint64_t ContentHash;
+  license_id Id;
+  int64_t StartTime;
+  uint32_t Status;
+  uint32_t EncryptionFileNameLength;
+  uint64_t FileNameOffset;
+  uint32_t CheckSumFileNameLength;
+  uint32_t Reserved;
+};
+
+/**
+ * @brief
+ * The statistics of loading a snapshot, i.e., how many licenses were restored without any verification, by their content hash, or by a full verification.
+ */
+struct LicenseSnapshotStatistics {
+  unsigned long Licenses;
+  unsigned long Unchanged;
+  unsigned long Rehashed;
+  unsigned long Reverified;
+  unsigned long Missing;
+  double Seconds;
+};
+
+/**
+ * @brief
+ * A persistent snapshot of the verified licenses, so that a restarted service does not need to decrypt every license file again before it is ready for the license checks.
+ *
+ * The snapshot file holds the verified state of each license with the identities of the files (device, inode, size, modification and change time) and their content hash.
+ * It is protected by a separate digest file with the SHA-256 digest of the snapshot file, which shall be stored in a protected location, like the root file of LicenseMerkleTree.
+ *
+ * The snapshot file is read into the records when it is loaded, and the licenses are restored into a LicenseRegistry in parallel:
+ * a license whose files are unchanged is restored with a stat of each file, one whose files changed identity but not content (e.g., copied) with a read of each file,
+ * and only the others are decrypted and verified again.
+ */
+class LicenseStateSnapshot
+{
+public:
+
+  LicenseStateSnapshot(double LicenseDuration, int ThreadCount, const prime_list &KeySchedule = prime_list(), const LicensePrimePool *PrimePool = nullptr);
+  OperationState AddLicense(const string &EncryptionFileName, const string &CheckSumFileName, LicenseRegistry &Registry);
+  OperationState AddLicenses(const license_file_list &Files, LicenseRegistry &Registry);
+  OperationState LoadSnapshotFile(const string &SnapshotFileName, const string &DigestFileName, LicenseRegistry &Registry);
+  OperationState WriteSnapshotFile(const string &SnapshotFileName, const string &DigestFileName) const;
+  LicenseSnapshotStatistics GetStatistics() const;
+
+private:
+  double LicenseDurationInDays;
+  int ThreadCount;
+  prime_list KeySchedule;
+  const LicensePrimePool *PrimePool;
+
+  vector<SnapshotRecord> Records;
+  string FileNames;
+  LicenseSnapshotStatistics Statistics;
+
+  int RestoreRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName) const;
+  OperationState VerifyRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName) const;
+  OperationState InsertRecord(const SnapshotRecord &Record, LicenseRegistry &Registry) const;
+  OperationState KeepRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName, LicenseRegistry &Registry);
+};
+
+#endif
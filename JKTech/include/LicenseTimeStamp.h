@@ -6,6 +6,8 @@
 #include <vector>
 #include <tuple>
 #include <list>
+#include <ctime>
+#include <stdint.h>
 
 using namespace std;
 /**
@@ -33,7 +35,50 @@ const int CHECKSUM_SIZE = 3001;
  */
 const bool DEBUG = true;
 
-typedef vector< tuple<double,double> > prime_list;
+/**
+ * @brief 
+ * The suffix of the temporary files, into which a timestamp file and its checksum file are staged before they replace the original files (see LicenseTimeStampOperation::StageTimeStampFile).
+ */
+const string STAGED_FILE_SUFFIX = ".tmp";
+
+/**
+ * @brief 
+ * The list of the prime pairs (p, q) used in RSA algorithm. The i-th byte of the timestamp is encrypted with the i-th pair (wrapped around the list).
+ */
+typedef vector< tuple<uint64_t,uint64_t> > prime_list;
+
+/**
+ * @brief 
+ * The identity of a license, i.e., a random serial drawn when the license is issued (see LicenseTimeStampOperation::GetLicenseId).
+ */
+typedef uint64_t license_id;
+
+/**
+ * @brief
+ * The list of the license records in a license store. Each record is a tuple of (encrypted timestamp file name, checksum file name).
+ */
+typedef vector< tuple<string,string> > license_file_list;
+
+/**
+ * @brief 
+ * The length of a well-formed timestamp string, e.g., "2022-02-16T10:00:00Z" (see LicenseTimeStampOperation::IsWellFormedTimeStamp).
+ */
+const size_t TIMESTAMP_LENGTH = 20;
+
+/**
+ * @brief 
+ * The number of hexadecimal digits of a license serial in the checksum file.
+ */
+const size_t LICENSE_SERIAL_DIGITS = 16;
+
+/**
+ * @brief 
+ * The number of hexadecimal digits of each prime pool index in the checksum file (see LicensePrimePool::DrawKeySchedule).
+ */
+const size_t KEY_INDEX_DIGITS = 8;
+
+class LicenseRevocationList;
+class LicensePrimePool;
 
 /**
  * @brief 
@@ -44,6 +89,8 @@ typedef vector< tuple<double,double> > prime_list;
  * @FILE_FAIL_OPEN: The operation needs to open a file. which fails to be opened.
  * @FILE_NOT_EXIST: The operation cannot be executed due to the missing file(s). It happened when the decryption of the timestamp file cannot find the file.
  * @FILE_EXIST: The operation cannot be executed because  the file(s) exist. It happened when the timestamp encryption found an existing encrypted timestamp file is available.
+ * @INTEGRITY_ROOT_MISMATCH: The root hash of the license store does not match the one in the root file. It happened when the license store or its integrity index has been tampered with.
+ * @LICENSE_REVOKED: The license has been revoked before its expiry. It happened when the license identity is found in the revocation list.
  */
 
 enum OperationState {
@@ -53,29 +100,53 @@ enum OperationState {
       FILE_NOT_EXIST,
       FILE_EXIST,
       TIMESTAMP_RETRIEVAL_ERROR,
-      TIMESTAMP_TAMPERED
+      TIMESTAMP_TAMPERED,
+      INTEGRITY_ROOT_MISMATCH,
+      LICENSE_REVOKED
 };
 
+/**
+ * @brief 
+ * A function to replace a file atomically, i.e., write the content into a temporary file ("<file name>.tmp"), flush it to the disk, rename it and flush the directory,
+ * so that the file is either the old one or the new one after a crash.
+ */
+OperationState WriteFileAtomically(const string &FileName, const string &Content);
+
+/**
+ * @brief 
+ * A function to flush the directory of a file to the disk, so that a file created or renamed in it is durable.
+ */
+OperationState SyncParentDirectory(const string &FileName);
+
 class LicenseTimeStampOperation
 {
 public:
  
   LicenseTimeStampOperation(string encryptionFileName, string CheckSumFileName, double LicenseDuration);
+  LicenseTimeStampOperation(string encryptionFileName, string CheckSumFileName, double LicenseDuration, const prime_list &KeySchedule, const LicensePrimePool *PrimePool = nullptr);
   OperationState CreateTimeStampFile(double* EncryptedOut,string &Encrypteddisplay);
+  OperationState EncryptTimeStamp(const string &TimeStamp, license_id Serial, double* EncryptedOut, string &EncryptedCheckSum, vector<uint32_t> &KeyIndexes, size_t &length);
+  OperationState StageTimeStampFile(const double* EncryptedOut, const string &EncryptedCheckSum, license_id Serial, const vector<uint32_t> &KeyIndexes, size_t length);
+  OperationState CommitTimeStampFile();
   OperationState InspectTimeStamp(string &outStr);
   bool IsTimeStampExpired();
+  bool IsTimeStampExpired(const LicenseRevocationList &RevocationList);
+  OperationState GetLicenseId(license_id &Id);
+  OperationState GetExpiryDeadline(time_t &StartTime, time_t &Deadline);
+  static bool IsWellFormedTimeStamp(const string &TimeStamp);
   const char* OperationStateToString(OperationState v);
 
 private:
   prime_list PrimeList;
+  const LicensePrimePool *PrimePool;
   OperationState ConvertcurrentDateToString(string &outStr);
-  double GetPublicKey(int index);
-  double GetPrivateKey(int index, double &N);
+  double GetPublicKey(const prime_list &KeySchedule, int index);
+  double GetPrivateKey(const prime_list &KeySchedule, int index, double &N);
   string EncryptionFileName;
   string CheckSumFileName;
   double LicenseDurationInDays;
-  OperationState writeIntoFile (double *Content, string hashCode, size_t length);
-  OperationState readFromFile (double* Content, size_t &length);
+  OperationState writeIntoFile (double *Content, string hashCode, license_id Serial, const vector<uint32_t> &KeyIndexes, size_t length);
+  OperationState readFromFile (double* Content, size_t &length, license_id &Serial, vector<uint32_t> &KeyIndexes);
 
 };
 
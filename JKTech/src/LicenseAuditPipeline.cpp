@@ -0,0 +1,332 @@
+/**
+ * @file LicenseAuditPipeline.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The audit pipeline to discover and verify all license pairs on a host.
+ *
+ * The directory trees are walked in parallel with getdents64 (see LicensePairScanner), so the directory entries are read in large batches without any stat call for the entries which are not license files.
+ * Each license pair is verified by the worker thread which found it.
+ * The results are buffered per worker thread and streamed out in chunks, so the memory usage does not grow with the number of license files.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseAuditPipeline.h"
+#include "../include/LicenseRevocationList.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief
+ * The size (in bytes) of the results buffered by each worker thread before they are written to the output.
+ */
+const size_t RESULT_BUFFER_SIZE = 64 * 1024;
+
+/**
+ * @brief
+ * A function to quote a field for CSV, if it contains a comma, a quote or a line break.
+ */
+static string CsvField(const string &field) {
+  if (field.find_first_of(",\"\r\n") == string::npos) {
+    return field;
+  }
+  string quoted = "\"";
+  for (size_t i = 0; i < field.length(); i++) {
+    if (field[i] == '"') {
+      quoted += '"';
+    }
+    quoted += field[i];
+  }
+  return quoted + "\"";
+}
+
+/**
+ * @brief
+ * A function to escape a string for JSON.
+ */
+static string JsonString(const string &field) {
+  string escaped = "\"";
+  for (size_t i = 0; i < field.length(); i++) {
+    unsigned char c = field[i];
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c < 0x20) {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      escaped += buffer;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped + "\"";
+}
+
+/**
+ * @brief
+ * A function to return the literal name of an operational state for the audit results (e.g., "TIMESTAMP_TAMPERED").
+ */
+static const char *OperationStateName(OperationState state) {
+  switch (state) {
+    case SUCCESS: return "SUCCESS";
+    case INVALID_PARAMETER: return "INVALID_PARAMETER";
+    case FILE_FAIL_OPEN: return "FILE_FAIL_OPEN";
+    case FILE_NOT_EXIST: return "FILE_NOT_EXIST";
+    case FILE_EXIST: return "FILE_EXIST";
+    case TIMESTAMP_RETRIEVAL_ERROR: return "TIMESTAMP_RETRIEVAL_ERROR";
+    case TIMESTAMP_TAMPERED: return "TIMESTAMP_TAMPERED";
+    case INTEGRITY_ROOT_MISMATCH: return "INTEGRITY_ROOT_MISMATCH";
+    case LICENSE_REVOKED: return "LICENSE_REVOKED";
+    default: return "UNKNOWN";
+  }
+}
+
+/**
+ * @brief Construct a new License Audit Pipeline:: License Audit Pipeline object
+ *
+ * @param LicenseDuration
+ * The license duration (in days)
+ * @param ThreadCount
+ * The number of worker threads to walk the directory trees and verify the license pairs
+ * @param EncryptedSuffix
+ * The suffix of the encrypted timestamp file names
+ * @param CheckSumSuffix
+ * The suffix of the checksum file names. The checksum file of "<prefix><EncryptedSuffix>" is "<prefix><CheckSumSuffix>" in the same directory.
+ */
+LicenseAuditPipeline::LicenseAuditPipeline(double LicenseDuration, int ThreadCount, string EncryptedSuffix, string CheckSumSuffix)
+  : LicenseDurationInDays(LicenseDuration), ThreadCount(ThreadCount < 1 ? 1 : ThreadCount), EncryptedSuffix(EncryptedSuffix), CheckSumSuffix(CheckSumSuffix),
+    RevocationList(nullptr), PrimePool(nullptr), ActiveWorkers(0), Output(nullptr), Format(AUDIT_CSV),
+    DirectoriesScanned(0), FilesScanned(0), PairsVerified(0), ValidLicenses(0), ExpiredLicenses(0), FailedLicenses(0), CheckSumFiles(0), MatchedCheckSumFiles(0), Seconds(0) {
+}
+
+/**
+ * @brief
+ * A method to check the audited licenses against a revocation list as well. The revocation list shall outlive the audit run.
+ */
+void LicenseAuditPipeline::SetRevocationList(const LicenseRevocationList *RevocationList) {
+  this->RevocationList = RevocationList;
+}
+
+/**
+ * @brief
+ * A method to look up the key schedules of the licenses issued from a prime pool (see LicenseTimeStampOperation). The prime pool shall outlive the audit run.
+ */
+void LicenseAuditPipeline::SetPrimePool(const LicensePrimePool *PrimePool) {
+  this->PrimePool = PrimePool;
+}
+
+/**
+ * @brief
+ * A method to run the audit over the given directory trees.
+ *
+ * @param RootDirectories
+ * The directory trees to be walked
+ * @param Output
+ * The stream to write the audit results into
+ * @param Format
+ * The output format of the audit results
+ * @return OperationState
+ * The operational state of the audit run. It fails if no directory is given, or a root directory cannot be opened.
+ */
+OperationState LicenseAuditPipeline::Run(const vector<string> &RootDirectories, ostream &Output, AuditOutputFormat Format) {
+  if (RootDirectories.empty()) {
+    return INVALID_PARAMETER;
+  }
+  for (size_t i = 0; i < RootDirectories.size(); i++) {
+    struct stat buffer;
+    if (stat(RootDirectories[i].c_str(), &buffer) != 0 || !S_ISDIR(buffer.st_mode)) {
+      cout << "Unable to open directory, " << RootDirectories[i] << endl;
+      return FILE_NOT_EXIST;
+    }
+  }
+
+  this->Output = &Output;
+  this->Format = Format;
+  PendingDirectories = RootDirectories;
+  ActiveWorkers = 0;
+  DirectoriesScanned = 0;
+  FilesScanned = 0;
+  PairsVerified = 0;
+  ValidLicenses = 0;
+  ExpiredLicenses = 0;
+  FailedLicenses = 0;
+  CheckSumFiles = 0;
+  MatchedCheckSumFiles = 0;
+
+  if (Format == AUDIT_CSV) {
+    Output << "encrypted_file,checksum_file,state,start_time,deadline,expired\n";
+  }
+
+  steady_clock::time_point start = steady_clock::now();
+
+  vector<thread> workers;
+  for (int i = 0; i < ThreadCount; i++) {
+    workers.push_back(thread(&LicenseAuditPipeline::RunWorker, this));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  Output.flush();
+
+  Seconds = duration<double>(steady_clock::now() - start).count();
+  this->Output = nullptr;
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * The loop of a worker thread: it takes the pending directories one by one, until no directory is pending and no other worker can add one.
+ */
+void LicenseAuditPipeline::RunWorker() {
+  LicensePairScanner scanner(EncryptedSuffix, CheckSumSuffix);
+  string results;
+
+  while (true) {
+    string directory;
+    {
+      unique_lock<mutex> guard(DirectoryMutex);
+      while (PendingDirectories.empty() && ActiveWorkers > 0) {
+        DirectoryCondition.wait(guard);
+      }
+      if (PendingDirectories.empty()) {
+        break;
+      }
+      directory = PendingDirectories.back();
+      PendingDirectories.pop_back();
+      ActiveWorkers++;
+    }
+
+    ScanDirectory(scanner, directory, results);
+
+    {
+      lock_guard<mutex> guard(DirectoryMutex);
+      ActiveWorkers--;
+    }
+    DirectoryCondition.notify_all();
+  }
+
+  FlushResults(results, true);
+  DirectoryCondition.notify_all();
+}
+
+/**
+ * @brief
+ * A function to read the entries of a directory in batches, queue its subdirectories, and verify its license pairs.
+ */
+void LicenseAuditPipeline::ScanDirectory(LicensePairScanner &Scanner, const string &Directory, string &Results) {
+  if (Scanner.Open(Directory) != SUCCESS) {
+    return;
+  }
+  DirectoriesScanned++;
+
+  LicensePairBatch batch;
+  while (Scanner.ReadBatch(batch)) {
+    FilesScanned += batch.RegularFiles;
+    CheckSumFiles += batch.CheckSumFiles;
+
+    // the subdirectories of this batch are handed over to the other workers before the license pairs of this batch are verified.
+    if (!batch.Subdirectories.empty()) {
+      {
+        lock_guard<mutex> guard(DirectoryMutex);
+        PendingDirectories.insert(PendingDirectories.end(), batch.Subdirectories.begin(), batch.Subdirectories.end());
+      }
+      DirectoryCondition.notify_all();
+    }
+
+    for (size_t i = 0; i < batch.Pairs.size(); i++) {
+      if (batch.Pairs[i].Paired) {
+        MatchedCheckSumFiles++;
+      }
+      VerifyPair(batch.Pairs[i].EncryptionFileName, batch.Pairs[i].CheckSumFileName, Results);
+    }
+  }
+}
+
+/**
+ * @brief
+ * A function to verify a license pair and append its result to the buffered results of the worker thread.
+ */
+void LicenseAuditPipeline::VerifyPair(const string &EncryptionFileName, const string &CheckSumFileName, string &Results) {
+  LicenseTimeStampOperation operation(EncryptionFileName, CheckSumFileName, LicenseDurationInDays, prime_list(), PrimePool);
+  time_t startTime = (time_t)(-1);
+  time_t deadline = (time_t)(-1);
+  OperationState state = operation.GetExpiryDeadline(startTime, deadline);
+  bool expired = true;
+
+  if (state == SUCCESS && RevocationList != nullptr) {
+    license_id id = 0;
+    state = operation.GetLicenseId(id);
+    if (state == SUCCESS && RevocationList->IsRevoked(id)) {
+      state = LICENSE_REVOKED;
+    }
+  }
+
+  PairsVerified++;
+  if (state == SUCCESS) {
+    time_t now = time(nullptr);
+    expired = now > deadline || now < startTime;
+    if (expired) {
+      ExpiredLicenses++;
+    } else {
+      ValidLicenses++;
+    }
+  } else {
+    FailedLicenses++;
+  }
+
+  if (Format == AUDIT_JSON) {
+    Results += "{\"encrypted_file\":" + JsonString(EncryptionFileName) + ",\"checksum_file\":" + JsonString(CheckSumFileName) +
+               ",\"state\":\"" + OperationStateName(state) + "\",\"start_time\":" + to_string((long long)startTime) +
+               ",\"deadline\":" + to_string((long long)deadline) + ",\"expired\":" + (expired ? "true" : "false") + "}\n";
+  } else {
+    Results += CsvField(EncryptionFileName) + "," + CsvField(CheckSumFileName) + "," + OperationStateName(state) + "," +
+               to_string((long long)startTime) + "," + to_string((long long)deadline) + "," + (expired ? "1" : "0") + "\n";
+  }
+
+  FlushResults(Results, false);
+}
+
+/**
+ * @brief
+ * A function to write the buffered results of a worker thread to the output, once the buffer is full (or at the end of the worker thread).
+ */
+void LicenseAuditPipeline::FlushResults(string &Results, bool Force) {
+  if (Results.empty() || (!Force && Results.length() < RESULT_BUFFER_SIZE)) {
+    return;
+  }
+
+  lock_guard<mutex> guard(OutputMutex);
+  Output->write(Results.data(), Results.length());
+  Results.clear();
+}
+
+/**
+ * @brief
+ * A method to retrieve the statistics of the last audit run.
+ */
+LicenseAuditStatistics LicenseAuditPipeline::GetStatistics() const {
+  LicenseAuditStatistics statistics;
+
+  statistics.DirectoriesScanned = DirectoriesScanned;
+  statistics.FilesScanned = FilesScanned;
+  statistics.PairsVerified = PairsVerified;
+  statistics.ValidLicenses = ValidLicenses;
+  statistics.ExpiredLicenses = ExpiredLicenses;
+  statistics.FailedLicenses = FailedLicenses;
+  statistics.OrphanCheckSumFiles = CheckSumFiles - MatchedCheckSumFiles;
+  statistics.Seconds = Seconds;
+
+  return statistics;
+}
@@ -0,0 +1,232 @@
+/**
+ * @file LicenseConcurrentVerifier.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The concurrent mode of the license timestamp operation.
+ *
+ * Decrypting the timestamp file on every expiry check from many request threads means a global lock around LicenseTimeStampOperation.
+ * Instead, a single verifier publishes the verified license as an immutable snapshot, and the reader threads only compare the current time with the snapshot.
+ *
+ * The replaced snapshots are reclaimed with hazard pointers (one slot per reader thread), so the reader threads never take a lock nor write to a shared cache line other than their own slot.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseConcurrentVerifier.h"
+#include "../include/LicenseRevocationList.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief
+ * A hazard pointer slot owned by a single reader thread. Each slot sits in its own cache line so that the reader threads do not share any cache line with each other.
+ */
+struct alignas(64) HazardSlot {
+  atomic<const void*> Pointer;
+  atomic<bool> Owned;
+};
+
+/**
+ * @brief
+ * The hazard pointer slots shared by all verifiers in the process. A reader thread protects one snapshot at a time, so one slot per thread is enough.
+ */
+static HazardSlot HazardSlots[MAX_HAZARD_THREADS];
+
+/**
+ * @brief
+ * The owner of a hazard pointer slot for the current thread. The slot is claimed on the first expiry check of the thread, and released when the thread exits.
+ */
+struct HazardSlotOwner {
+  HazardSlot *Slot;
+
+  HazardSlotOwner() : Slot(nullptr) {
+    for (int i = 0; i < MAX_HAZARD_THREADS; i++) {
+      bool owned = false;
+      if (HazardSlots[i].Owned.compare_exchange_strong(owned, true)) {
+        Slot = &HazardSlots[i];
+        break;
+      }
+    }
+  }
+
+  ~HazardSlotOwner() {
+    if (Slot != nullptr) {
+      Slot->Pointer.store(nullptr);
+      Slot->Owned.store(false);
+    }
+  }
+};
+
+/**
+ * @brief
+ * A function to retrieve the hazard pointer slot of the current thread.
+ *
+ * @return HazardSlot*
+ * The slot of the current thread, or nullptr if all slots are owned by other threads.
+ */
+static HazardSlot *GetHazardSlot() {
+  static thread_local HazardSlotOwner owner;
+  return owner.Slot;
+}
+
+/**
+ * @brief Construct a new License Concurrent Verifier:: License Concurrent Verifier object
+ *
+ * No snapshot is published until the first Refresh, so the license is treated as expired until then.
+ *
+ * @param encryptionFileName
+ * The location and file name of the encrypted timestamp file
+ * @param checksumFileName
+ * The location and file name of the timestamp checksum file (for file tamper check)
+ * @param LicenseDuration
+ * The license duration (in days)
+ * @param PrimePool
+ * The prime pool to look up the key schedule of a license issued from it, or nullptr (see LicenseTimeStampOperation)
+ */
+LicenseConcurrentVerifier::LicenseConcurrentVerifier(string encryptionFileName, string checksumFileName, double LicenseDuration, const LicensePrimePool *PrimePool)
+  : Operation(encryptionFileName, checksumFileName, LicenseDuration, prime_list(), PrimePool), Current(nullptr), Generation(0) {
+}
+
+/**
+ * @brief Destroy the License Concurrent Verifier:: License Concurrent Verifier object
+ *
+ * No reader thread shall check the expiry with this verifier any more.
+ */
+LicenseConcurrentVerifier::~LicenseConcurrentVerifier() {
+  delete Current.load();
+  for (size_t i = 0; i < Retired.size(); i++) {
+    delete Retired[i];
+  }
+}
+
+/**
+ * @brief
+ * A method to verify the timestamp file again and publish the result as a new snapshot to the reader threads. It shall be called by the verifier only (e.g., periodically, or after the license was renewed or revoked).
+ *
+ * @param RevocationList
+ * The revocation list to check the license identity against, or nullptr to skip the revocation check
+ * @return OperationState
+ * The operational state of the verification. The new snapshot is published even if the verification fails, so that the reader threads see the license as expired.
+ */
+OperationState LicenseConcurrentVerifier::Refresh(const LicenseRevocationList *RevocationList) {
+  lock_guard<mutex> guard(VerifierMutex);
+
+  VerifiedLicenseSnapshot *snapshot = new VerifiedLicenseSnapshot();
+  snapshot->State = Operation.GetExpiryDeadline(snapshot->StartTime, snapshot->Deadline);
+
+  license_id id = 0;
+  if (snapshot->State == SUCCESS && RevocationList != nullptr) {
+    snapshot->State = Operation.GetLicenseId(id);
+    if (snapshot->State == SUCCESS && RevocationList->IsRevoked(id)) {
+      snapshot->State = LICENSE_REVOKED;
+    }
+  }
+  snapshot->Generation = Generation++;
+
+  const VerifiedLicenseSnapshot *previous = Current.exchange(snapshot);
+  if (previous != nullptr) {
+    Retired.push_back(previous);
+  }
+  Reclaim();
+
+  return snapshot->State;
+}
+
+/**
+ * @brief
+ * A function to delete the replaced snapshots which are not protected by any reader thread. It is called with the verifier lock held.
+ */
+void LicenseConcurrentVerifier::Reclaim() {
+  vector<const void*> hazards;
+
+  for (int i = 0; i < MAX_HAZARD_THREADS; i++) {
+    const void *p = HazardSlots[i].Pointer.load();
+    if (p != nullptr) {
+      hazards.push_back(p);
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < Retired.size(); i++) {
+    if (find(hazards.begin(), hazards.end(), (const void*)Retired[i]) != hazards.end()) {
+      Retired[kept++] = Retired[i];
+    } else {
+      delete Retired[i];
+    }
+  }
+  Retired.resize(kept);
+}
+
+/**
+ * @brief
+ * A method to copy the latest snapshot without any lock.
+ *
+ * @param Snapshot
+ * The copy of the latest snapshot
+ * @return true
+ * A snapshot has been published
+ * @return false
+ * No snapshot has been published yet (i.e., Refresh has not been called)
+ */
+bool LicenseConcurrentVerifier::GetSnapshot(VerifiedLicenseSnapshot &Snapshot) const {
+  HazardSlot *slot = GetHazardSlot();
+  const VerifiedLicenseSnapshot *current;
+
+  // too many reader threads, fall back to the verifier lock, under which no snapshot can be reclaimed.
+  if (slot == nullptr) {
+    lock_guard<mutex> guard(VerifierMutex);
+    current = Current.load();
+    if (current == nullptr) {
+      return false;
+    }
+    Snapshot = *current;
+    return true;
+  }
+
+  // announce the snapshot to be read, and make sure it is still the current one after the announcement, so that the verifier cannot have missed it.
+  do {
+    current = Current.load();
+    slot->Pointer.store(current);
+  } while (current != Current.load());
+
+  if (current != nullptr) {
+    Snapshot = *current;
+  }
+  slot->Pointer.store(nullptr, memory_order_release);
+
+  return current != nullptr;
+}
+
+/**
+ * @brief
+ * An API to check if the timestamp has expired against the latest snapshot, without any lock. It is safe to be called from any number of threads.
+ *
+ * @param NowTime
+ * The time to check the expiry against
+ * @return true
+ * The timestamp has expired, or the verification failed, or no snapshot has been published yet
+ * @return false
+ * The timestamp has not expired
+ */
+bool LicenseConcurrentVerifier::IsTimeStampExpired(time_t NowTime) const {
+  VerifiedLicenseSnapshot snapshot;
+
+  if (!GetSnapshot(snapshot) || snapshot.State != SUCCESS) {
+    return true;
+  }
+
+  // the same rule as LicenseTimeStampOperation::IsTimeStampExpired, i.e., a start time in the future means that the clock has been turned back.
+  return NowTime > snapshot.Deadline || NowTime < snapshot.StartTime;
+}
+
+bool LicenseConcurrentVerifier::IsTimeStampExpired() const {
+  return IsTimeStampExpired(system_clock::to_time_t(system_clock::now()));
+}
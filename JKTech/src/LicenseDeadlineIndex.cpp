@@ -0,0 +1,562 @@
+/**
+ * @file LicenseDeadlineIndex.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The persistent deadline index, to answer "which licenses expire within N days" without decrypting every license file.
+ *
+ * The index is a sorted run of (deadline, id) entries plus a sparse index, and a journal of the updates since the run was written.
+ * The run is only rewritten when the journal is compacted, so issuing or renewing a license costs a single append to the journal.
+ * Several processes may update the same index: the appends take a shared lock on the journal file, and the replay and the compaction an exclusive one.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseDeadlineIndex.h"
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The header of the index file.
+ */
+struct DeadlineIndexFileHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint64_t Count;
+};
+
+/**
+ * @brief
+ * A record of the journal file, i.e., the new deadline of a license, or REMOVED_DEADLINE if the license has been removed.
+ */
+struct DeadlineJournalRecord {
+  license_id Id;
+  int64_t Deadline;
+};
+
+const char DEADLINE_INDEX_MAGIC[4] = {'L', 'D', 'L', 'X'};
+const uint32_t DEADLINE_INDEX_VERSION = 1;
+const int64_t REMOVED_DEADLINE = numeric_limits<int64_t>::min();
+
+static bool CompareEntries(const DeadlineIndexEntry &a, const DeadlineIndexEntry &b) {
+  return a.Deadline < b.Deadline || (a.Deadline == b.Deadline && a.Id < b.Id);
+}
+
+LicenseDeadlineIndex::LicenseDeadlineIndex()
+  : JournalDescriptor(-1), Mapping(nullptr), MappingLength(0), Run(nullptr), RunSize(0), RunDevice(0), RunInode(0), JournalSize(0) {
+}
+
+LicenseDeadlineIndex::~LicenseDeadlineIndex() {
+  UnloadRun();
+  if (JournalDescriptor >= 0) {
+    close(JournalDescriptor);
+  }
+}
+
+/**
+ * @brief
+ * A function to release the memory mapping of the sorted run and its sparse index.
+ */
+void LicenseDeadlineIndex::UnloadRun() {
+  if (Mapping != nullptr) {
+    munmap(Mapping, MappingLength);
+  }
+  Mapping = nullptr;
+  MappingLength = 0;
+  Run = nullptr;
+  RunSize = 0;
+  RunDevice = 0;
+  RunInode = 0;
+  SparseIndex.clear();
+}
+
+/**
+ * @brief
+ * A method to open the index. The sorted run is loaded from the index file (if it exists), and the journal is replayed on top of it.
+ *
+ * @param IndexFileName
+ * The location and file name of the index file. The journal is kept next to it as "<index file>.journal".
+ * @return OperationState
+ * The operational state of opening the index
+ */
+OperationState LicenseDeadlineIndex::Open(const string &IndexFileName) {
+  OperationState ret = SUCCESS;
+
+  if (IndexFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  UnloadRun();
+  if (JournalDescriptor >= 0) {
+    close(JournalDescriptor);
+    JournalDescriptor = -1;
+  }
+  Overrides.clear();
+  PendingEntries.clear();
+  JournalSize = 0;
+
+  this->IndexFileName = IndexFileName;
+  JournalFileName = IndexFileName + ".journal";
+
+  if ((ret = LoadRun()) != SUCCESS) {
+    return ret;
+  }
+
+  JournalDescriptor = open(JournalFileName.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (JournalDescriptor < 0) {
+    cout << "Unable to open file, " << JournalFileName << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  // the replay may discard a partially written record, which shall not be the append of another process in progress.
+  if (flock(JournalDescriptor, LOCK_EX) != 0) {
+    return FILE_FAIL_OPEN;
+  }
+  ret = ReplayJournal();
+  flock(JournalDescriptor, LOCK_UN);
+
+  return ret;
+}
+
+/**
+ * @brief
+ * A function to memory-map the sorted run of the index file, and build its sparse index. A missing index file is an empty run.
+ */
+OperationState LicenseDeadlineIndex::LoadRun() {
+  int fd = open(IndexFileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return SUCCESS;
+  }
+
+  struct stat buffer;
+  if (fstat(fd, &buffer) != 0 || (size_t)buffer.st_size < sizeof(DeadlineIndexFileHeader)) {
+    close(fd);
+    cout << "Malformed index file, " << IndexFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  MappingLength = buffer.st_size;
+  RunDevice = buffer.st_dev;
+  RunInode = buffer.st_ino;
+  Mapping = mmap(nullptr, MappingLength, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (Mapping == MAP_FAILED) {
+    Mapping = nullptr;
+    MappingLength = 0;
+    return FILE_FAIL_OPEN;
+  }
+
+  const DeadlineIndexFileHeader *header = (const DeadlineIndexFileHeader *)Mapping;
+  if (memcmp(header->Magic, DEADLINE_INDEX_MAGIC, sizeof(header->Magic)) != 0 || header->Version != DEADLINE_INDEX_VERSION ||
+      header->Count != (MappingLength - sizeof(DeadlineIndexFileHeader)) / sizeof(DeadlineIndexEntry)) {
+    UnloadRun();
+    cout << "Malformed index file, " << IndexFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  Run = (const DeadlineIndexEntry *)((const char *)Mapping + sizeof(DeadlineIndexFileHeader));
+  RunSize = header->Count;
+
+  SparseIndex.reserve(RunSize / SPARSE_INDEX_INTERVAL + 1);
+  for (size_t i = 0; i < RunSize; i += SPARSE_INDEX_INTERVAL) {
+    SparseIndex.push_back(Run[i].Deadline);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to replay the journal into memory. A partially written record at the end of the journal (e.g., after a crash) is discarded.
+ */
+OperationState LicenseDeadlineIndex::ReplayJournal() {
+  DeadlineJournalRecord records[1024];
+  size_t remainder = 0;
+  off_t offset = 0;
+
+  while (true) {
+    ssize_t bytes = pread(JournalDescriptor, (char *)records + remainder, sizeof(records) - remainder, offset);
+    if (bytes < 0) {
+      return FILE_FAIL_OPEN;
+    }
+    if (bytes == 0) {
+      break;
+    }
+    offset += bytes;
+
+    size_t available = remainder + bytes;
+    size_t count = available / sizeof(DeadlineJournalRecord);
+    for (size_t i = 0; i < count; i++) {
+      ApplyUpdate(records[i].Id, records[i].Deadline);
+    }
+    JournalSize += count;
+
+    remainder = available % sizeof(DeadlineJournalRecord);
+    memmove(records, (char *)records + count * sizeof(DeadlineJournalRecord), remainder);
+  }
+
+  if (remainder != 0 && ftruncate(JournalDescriptor, offset - remainder) != 0) {
+    return FILE_FAIL_OPEN;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to apply an update of a license to the in-memory state. The entry of the license in the sorted run, if any, is hidden by the override.
+ */
+void LicenseDeadlineIndex::ApplyUpdate(license_id Id, int64_t Deadline) {
+  unordered_map<license_id, int64_t>::iterator it = Overrides.find(Id);
+
+  if (it != Overrides.end()) {
+    if (it->second != REMOVED_DEADLINE) {
+      PendingEntries.erase(make_pair(it->second, Id));
+    }
+    it->second = Deadline;
+  } else {
+    Overrides[Id] = Deadline;
+  }
+
+  if (Deadline != REMOVED_DEADLINE) {
+    PendingEntries.insert(make_pair(Deadline, Id));
+  }
+}
+
+/**
+ * @brief
+ * A function to append an update to the journal file. It is a single write of a single record, so the concurrent appends of other processes cannot interleave with it.
+ * The write is made under a shared lock, so it cannot fall between the read and the truncation of the journal by a compaction in another process.
+ */
+OperationState LicenseDeadlineIndex::AppendJournal(license_id Id, int64_t Deadline) {
+  if (JournalDescriptor < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  DeadlineJournalRecord record;
+  record.Id = Id;
+  record.Deadline = Deadline;
+
+  if (flock(JournalDescriptor, LOCK_SH) != 0) {
+    return FILE_FAIL_OPEN;
+  }
+  bool written = write(JournalDescriptor, &record, sizeof(record)) == (ssize_t)sizeof(record);
+  flock(JournalDescriptor, LOCK_UN);
+
+  if (!written) {
+    cout << "Unable to write file, " << JournalFileName << endl;
+    return FILE_FAIL_OPEN;
+  }
+  JournalSize++;
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * An API to add a license to the index, or to update its deadline (e.g., when the license is issued or renewed).
+ *
+ * @param Id
+ * The license identity (see LicenseTimeStampOperation::GetLicenseId)
+ * @param Deadline
+ * The license expiry deadline (see LicenseTimeStampOperation::GetExpiryDeadline)
+ * @return OperationState
+ * The operational state of the update
+ */
+OperationState LicenseDeadlineIndex::UpsertLicense(license_id Id, time_t Deadline) {
+  OperationState ret = SUCCESS;
+
+  if ((int64_t)Deadline == REMOVED_DEADLINE) {
+    return INVALID_PARAMETER;
+  }
+  if ((ret = AppendJournal(Id, Deadline)) != SUCCESS) {
+    return ret;
+  }
+  ApplyUpdate(Id, Deadline);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * An API to remove a license from the index (e.g., when it was replaced by a renewed license with a new identity).
+ *
+ * @param Id
+ * The license identity
+ * @return OperationState
+ * The operational state of the removal
+ */
+OperationState LicenseDeadlineIndex::RemoveLicense(license_id Id) {
+  OperationState ret = SUCCESS;
+
+  if ((ret = AppendJournal(Id, REMOVED_DEADLINE)) != SUCCESS) {
+    return ret;
+  }
+  ApplyUpdate(Id, REMOVED_DEADLINE);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * An API to add an issued license to the index, from its timestamp file and checksum file.
+ *
+ * @param Operation
+ * The license timestamp operation of the license
+ * @return OperationState
+ * The operational state of the update. It fails if the license cannot be verified.
+ */
+OperationState LicenseDeadlineIndex::IndexLicense(LicenseTimeStampOperation &Operation) {
+  OperationState ret = SUCCESS;
+  time_t startTime, deadline;
+  license_id id;
+
+  if ((ret = Operation.GetExpiryDeadline(startTime, deadline)) != SUCCESS || (ret = Operation.GetLicenseId(id)) != SUCCESS) {
+    return ret;
+  }
+
+  return UpsertLicense(id, deadline);
+}
+
+/**
+ * @brief
+ * An API to find all licenses whose deadline is within [From, To].
+ *
+ * @param From
+ * The start of the time range (inclusive)
+ * @param To
+ * The end of the time range (inclusive)
+ * @param Ids
+ * The identities of the licenses, ordered by their deadlines
+ * @return OperationState
+ * The operational state of the query
+ */
+OperationState LicenseDeadlineIndex::QueryRange(time_t From, time_t To, vector<license_id> &Ids) const {
+  Ids.clear();
+
+  if (From > To) {
+    return INVALID_PARAMETER;
+  }
+
+  vector< pair<int64_t, license_id> > found;
+
+  if (RunSize > 0) {
+    // the first entry in range lies after the last sparse key below From, and no later than the next sparse key.
+    size_t block = lower_bound(SparseIndex.begin(), SparseIndex.end(), (int64_t)From) - SparseIndex.begin();
+    size_t first = block == 0 ? 0 : (block - 1) * SPARSE_INDEX_INTERVAL;
+    size_t last = min(RunSize, block * SPARSE_INDEX_INTERVAL + 1);
+    DeadlineIndexEntry key;
+    key.Deadline = From;
+    key.Id = 0;
+
+    for (const DeadlineIndexEntry *entry = lower_bound(Run + first, Run + last, key, CompareEntries); entry < Run + RunSize && entry->Deadline <= (int64_t)To; entry++) {
+      if (Overrides.empty() || Overrides.find(entry->Id) == Overrides.end()) {
+        found.push_back(make_pair(entry->Deadline, entry->Id));
+      }
+    }
+  }
+
+  size_t fromRun = found.size();
+  for (set< pair<int64_t, license_id> >::const_iterator it = PendingEntries.lower_bound(make_pair((int64_t)From, (license_id)0));
+       it != PendingEntries.end() && it->first <= (int64_t)To; ++it) {
+    found.push_back(*it);
+  }
+  inplace_merge(found.begin(), found.begin() + fromRun, found.end());
+
+  Ids.reserve(found.size());
+  for (size_t i = 0; i < found.size(); i++) {
+    Ids.push_back(found[i].second);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * An API to find all licenses expiring from now on within the given number of days.
+ *
+ * @param Days
+ * The number of days from now
+ * @param Ids
+ * The identities of the licenses, ordered by their deadlines
+ * @return OperationState
+ * The operational state of the query
+ */
+OperationState LicenseDeadlineIndex::QueryExpiringWithin(double Days, vector<license_id> &Ids) const {
+  if (Days < 0) {
+    Ids.clear();
+    return INVALID_PARAMETER;
+  }
+
+  time_t now = time(nullptr);
+  return QueryRange(now, now + (time_t)(Days * 60 * 60 * 24), Ids);
+}
+
+/**
+ * @brief
+ * An API to merge the journal into a new sorted run. The new index file is written into a temporary file and renamed, and the journal is truncated afterwards.
+ * If the process crashes in between, the journal is replayed on top of the new run, which gives the same result.
+ *
+ * The journal is locked exclusively from its read to its truncation. If another process has appended to the journal or compacted it since the index was opened,
+ * the run and the journal are read again under the lock, so its updates are merged rather than lost.
+ *
+ * @return OperationState
+ * The operational state of the compaction
+ */
+OperationState LicenseDeadlineIndex::Compact() {
+  OperationState ret = SUCCESS;
+
+  if (IndexFileName.empty() || JournalDescriptor < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  if (flock(JournalDescriptor, LOCK_EX) != 0) {
+    return FILE_FAIL_OPEN;
+  }
+
+  if (!IsCurrent()) {
+    UnloadRun();
+    Overrides.clear();
+    PendingEntries.clear();
+    JournalSize = 0;
+    if ((ret = LoadRun()) == SUCCESS) {
+      ret = ReplayJournal();
+    }
+  }
+
+  if (ret == SUCCESS && (ret = WriteRun()) == SUCCESS) {
+    if (ftruncate(JournalDescriptor, 0) != 0 || fsync(JournalDescriptor) != 0) {
+      // the journal is replayed on top of the new run, which gives the same result.
+      ret = FILE_FAIL_OPEN;
+    } else {
+      Overrides.clear();
+      PendingEntries.clear();
+      JournalSize = 0;
+    }
+    UnloadRun();
+    if (LoadRun() != SUCCESS) {
+      ret = FILE_FAIL_OPEN;
+    }
+  }
+
+  flock(JournalDescriptor, LOCK_UN);
+  return ret;
+}
+
+/**
+ * @brief
+ * A function to check, under the lock of the journal, if the in-memory state is the one on the disk: the index file has not been replaced
+ * (the mapped run keeps its inode in use, so the inode cannot be reused), and the journal only holds the updates replayed or appended by this index.
+ */
+bool LicenseDeadlineIndex::IsCurrent() const {
+  struct stat journal, run;
+
+  if (fstat(JournalDescriptor, &journal) != 0 || (size_t)journal.st_size != JournalSize * sizeof(DeadlineJournalRecord)) {
+    return false;
+  }
+  if (stat(IndexFileName.c_str(), &run) != 0) {
+    return Mapping == nullptr && errno == ENOENT;
+  }
+  return Mapping != nullptr && run.st_dev == RunDevice && run.st_ino == RunInode;
+}
+
+/**
+ * @brief
+ * A function to write the run merged with the journal into a temporary file, and rename it over the index file. The directory is flushed after the rename,
+ * so the new run is the one found after a crash once the journal is truncated.
+ */
+OperationState LicenseDeadlineIndex::WriteRun() {
+  string temporaryFileName = IndexFileName + ".tmp";
+  FILE *file = fopen(temporaryFileName.c_str(), "wb");
+  if (file == nullptr) {
+    cout << "Unable to open file, " << temporaryFileName << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  DeadlineIndexFileHeader header;
+  memcpy(header.Magic, DEADLINE_INDEX_MAGIC, sizeof(header.Magic));
+  header.Version = DEADLINE_INDEX_VERSION;
+  header.Count = 0;
+  fwrite(&header, sizeof(header), 1, file);
+
+  // merge the entries of the run which are not overridden with the pending entries, both of which are sorted.
+  size_t i = 0;
+  set< pair<int64_t, license_id> >::const_iterator pending = PendingEntries.begin();
+  while (true) {
+    while (i < RunSize && Overrides.find(Run[i].Id) != Overrides.end()) {
+      i++;
+    }
+    bool fromRun = i < RunSize;
+    bool fromPending = pending != PendingEntries.end();
+    if (!fromRun && !fromPending) {
+      break;
+    }
+
+    DeadlineIndexEntry entry;
+    if (fromRun && (!fromPending || Run[i].Deadline < pending->first || (Run[i].Deadline == pending->first && Run[i].Id < pending->second))) {
+      entry = Run[i++];
+    } else {
+      entry.Deadline = pending->first;
+      entry.Id = pending->second;
+      ++pending;
+    }
+    fwrite(&entry, sizeof(entry), 1, file);
+    header.Count++;
+  }
+
+  fseek(file, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file);
+  bool failed = fflush(file) != 0 || fsync(fileno(file)) != 0;
+  failed = fclose(file) != 0 || failed;
+
+  if (failed || rename(temporaryFileName.c_str(), IndexFileName.c_str()) != 0) {
+    cout << "Unable to write file, " << IndexFileName << endl;
+    unlink(temporaryFileName.c_str());
+    return FILE_FAIL_OPEN;
+  }
+
+  return SyncParentDirectory(IndexFileName);
+}
+
+/**
+ * @brief
+ * An API to flush the journal to the disk, so that the updates survive a power failure.
+ */
+OperationState LicenseDeadlineIndex::Sync() {
+  if (JournalDescriptor < 0) {
+    return FILE_NOT_EXIST;
+  }
+  return fdatasync(JournalDescriptor) == 0 ? SUCCESS : FILE_FAIL_OPEN;
+}
+
+/**
+ * @brief
+ * A method to retrieve the number of entries in the sorted run.
+ */
+size_t LicenseDeadlineIndex::GetRunSize() const {
+  return RunSize;
+}
+
+/**
+ * @brief
+ * A method to retrieve the number of updates in the journal, to decide when to compact it.
+ */
+size_t LicenseDeadlineIndex::GetJournalSize() const {
+  return JournalSize;
+}
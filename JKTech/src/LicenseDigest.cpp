@@ -0,0 +1,223 @@
+/**
+ * @file LicenseDigest.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * A self-contained SHA-256 implementation (FIPS 180-4) used by the integrity index of the license store.
+ *
+ * It is kept inside this library on purpose so that the library can still be built with the plain makefile, without linking any crypto library.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseDigest.h"
+#include <string.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The round constants of SHA-256
+ */
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t RotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @brief
+ * The running state of a SHA-256 computation
+ */
+struct Sha256State {
+  uint32_t H[8];
+  uint8_t Block[64];
+  size_t BlockLength;
+  uint64_t TotalLength;
+};
+
+static void Sha256Init(Sha256State &s) {
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(s.H, init, sizeof(init));
+  s.BlockLength = 0;
+  s.TotalLength = 0;
+}
+
+static void Sha256Compress(Sha256State &s, const uint8_t *block) {
+  uint32_t w[64];
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+  }
+  for (i = 16; i < 64; i++) {
+    uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = s.H[0], b = s.H[1], c = s.H[2], d = s.H[3];
+  uint32_t e = s.H[4], f = s.H[5], g = s.H[6], h = s.H[7];
+
+  for (i = 0; i < 64; i++) {
+    uint32_t S1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + S1 + ch + K[i] + w[i];
+    uint32_t S0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = S0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  s.H[0] += a; s.H[1] += b; s.H[2] += c; s.H[3] += d;
+  s.H[4] += e; s.H[5] += f; s.H[6] += g; s.H[7] += h;
+}
+
+static void Sha256Update(Sha256State &s, const uint8_t *data, size_t length) {
+  s.TotalLength += length;
+
+  while (length > 0) {
+    size_t n = 64 - s.BlockLength;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(s.Block + s.BlockLength, data, n);
+    s.BlockLength += n;
+    data += n;
+    length -= n;
+
+    if (s.BlockLength == 64) {
+      Sha256Compress(s, s.Block);
+      s.BlockLength = 0;
+    }
+  }
+}
+
+static license_digest Sha256Final(Sha256State &s) {
+  uint64_t bitLength = s.TotalLength * 8;
+  uint8_t pad = 0x80;
+  uint8_t zero = 0;
+  uint8_t lengthBytes[8];
+  int i;
+
+  Sha256Update(s, &pad, 1);
+  while (s.BlockLength != 56) {
+    Sha256Update(s, &zero, 1);
+  }
+  for (i = 0; i < 8; i++) {
+    lengthBytes[i] = (uint8_t)(bitLength >> (56 - 8 * i));
+  }
+  Sha256Update(s, lengthBytes, 8);
+
+  license_digest out;
+  for (i = 0; i < 8; i++) {
+    out[i * 4] = (uint8_t)(s.H[i] >> 24);
+    out[i * 4 + 1] = (uint8_t)(s.H[i] >> 16);
+    out[i * 4 + 2] = (uint8_t)(s.H[i] >> 8);
+    out[i * 4 + 3] = (uint8_t)(s.H[i]);
+  }
+  return out;
+}
+
+license_digest ComputeDigest(const void *Data, size_t Length, int Prefix) {
+  Sha256State s;
+  Sha256Init(s);
+
+  if (Prefix >= 0) {
+    uint8_t p = (uint8_t)Prefix;
+    Sha256Update(s, &p, 1);
+  }
+  Sha256Update(s, (const uint8_t *)Data, Length);
+
+  return Sha256Final(s);
+}
+
+license_digest ComputeDigest(const license_digest &Left, const license_digest &Right, int Prefix) {
+  uint8_t buffer[2 * DIGEST_SIZE];
+
+  memcpy(buffer, Left.data(), DIGEST_SIZE);
+  memcpy(buffer + DIGEST_SIZE, Right.data(), DIGEST_SIZE);
+
+  return ComputeDigest(buffer, sizeof(buffer), Prefix);
+}
+
+license_digest ComputeDigest(const vector< pair<const void *, size_t> > &Parts) {
+  Sha256State s;
+  Sha256Init(s);
+
+  for (size_t i = 0; i < Parts.size(); i++) {
+    Sha256Update(s, (const uint8_t *)Parts[i].first, Parts[i].second);
+  }
+
+  return Sha256Final(s);
+}
+
+string DigestToString(const license_digest &Digest) {
+  static const char hex[] = "0123456789abcdef";
+  string s = "";
+
+  for (int i = 0; i < DIGEST_SIZE; i++) {
+    s += hex[Digest[i] >> 4];
+    s += hex[Digest[i] & 0x0f];
+  }
+  return s;
+}
+
+/**
+ * @brief
+ * A function to convert a single hexadecimal character to its value
+ *
+ * @return int
+ * The value of the character, or -1 if it is not a hexadecimal character
+ */
+static int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool StringToDigest(const string &Hex, license_digest &Digest) {
+  if (Hex.length() != 2 * DIGEST_SIZE) {
+    return false;
+  }
+
+  for (int i = 0; i < DIGEST_SIZE; i++) {
+    int high = HexValue(Hex[2 * i]);
+    int low = HexValue(Hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    Digest[i] = (uint8_t)((high << 4) | low);
+  }
+  return true;
+}
@@ -0,0 +1,625 @@
+/**
+ * @file LicenseMerkleTree.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The Merkle tree (integrity index) over the license records of a large license store.
+ *
+ * Comparing the checksum string of every license means rereading every checksum file. With a Merkle tree, the whole store is represented by a single root hash,
+ * which is kept in a separate root file (as the checksum file is kept separately from the encrypted timestamp file).
+ *
+ * The leaves are laid out level by level in arrays, so the nodes of a subtree are contiguous in each level and the subtrees can be hashed in parallel.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseMerkleTree.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <string.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The prefix bytes to separate the leaf hashes from the internal node hashes, so that an internal node can never be presented as a leaf (second pre-image attack).
+ */
+const int LEAF_PREFIX = 0x00;
+const int NODE_PREFIX = 0x01;
+
+/**
+ * @brief
+ * The magic number and the version of the index file.
+ */
+const char INDEX_MAGIC[4] = {'L', 'M', 'K', 'T'};
+const uint32_t INDEX_VERSION = 1;
+
+LicenseMerkleTree::LicenseMerkleTree() {
+}
+
+/**
+ * @brief
+ * A function to hash a single license record into a leaf
+ */
+static license_digest ComputeLeaf(const string &Record) {
+  return ComputeDigest(Record.data(), Record.length(), LEAF_PREFIX);
+}
+
+/**
+ * @brief
+ * A function to compute the number of threads actually used for a given number of records.
+ */
+static int ClampThreadCount(int ThreadCount, size_t RecordCount) {
+  if (ThreadCount < 1) {
+    ThreadCount = 1;
+  }
+  if (ThreadCount > MAX_MERKLE_THREADS) {
+    ThreadCount = MAX_MERKLE_THREADS;
+  }
+  if ((size_t)ThreadCount > RecordCount) {
+    ThreadCount = RecordCount > 0 ? (int)RecordCount : 1;
+  }
+  return ThreadCount;
+}
+
+/**
+ * @brief
+ * A function to compute the number of leaves covered by each subtree, given the number of threads.
+ * It is a power of two, so that the subtrees are aligned in every level of the tree.
+ */
+static size_t SubtreeSpan(size_t RecordCount, int ThreadCount) {
+  size_t span = 1;
+  while (span * ThreadCount < RecordCount) {
+    span <<= 1;
+  }
+  return span;
+}
+
+/**
+ * @brief
+ * A function to read a license record (i.e., the content of the encrypted timestamp file and its checksum file) into a string.
+ *
+ * @param EncryptionFileName
+ * The location and file name of the encrypted timestamp file
+ * @param CheckSumFileName
+ * The location and file name of the timestamp checksum file
+ * @param Record
+ * The license record read from both files
+ * @return OperationState
+ * The operational state of reading the license record
+ */
+OperationState LicenseMerkleTree::ReadLicenseRecord(const string &EncryptionFileName, const string &CheckSumFileName, string &Record) {
+
+  if (EncryptionFileName.empty() || CheckSumFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  ifstream enfile(EncryptionFileName, ios::binary);
+  if (!enfile.is_open()) {
+    return FILE_NOT_EXIST;
+  }
+  stringstream encrypted;
+  encrypted << enfile.rdbuf();
+  enfile.close();
+
+  ifstream checksumFile(CheckSumFileName, ios::binary);
+  if (!checksumFile.is_open()) {
+    return FILE_NOT_EXIST;
+  }
+  stringstream checksum;
+  checksum << checksumFile.rdbuf();
+  checksumFile.close();
+
+  // the length of the encrypted content is prefixed, so that the boundary between both files cannot be shifted without changing the hash.
+  string encryptedContent = encrypted.str();
+  Record = to_string(encryptedContent.length()) + ":" + encryptedContent + checksum.str();
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to allocate the levels of the tree for a given number of records. The level 0 holds the leaves and the last level holds the root.
+ */
+void LicenseMerkleTree::ResizeLevels(size_t RecordCount) {
+  Levels.clear();
+
+  if (RecordCount == 0) {
+    return;
+  }
+
+  Levels.push_back(vector<license_digest>(RecordCount));
+  while (Levels.back().size() > 1) {
+    Levels.push_back(vector<license_digest>((Levels.back().size() + 1) / 2));
+  }
+}
+
+/**
+ * @brief
+ * A function to compute an internal node from its children. A node without the right child is promoted as it is.
+ */
+license_digest LicenseMerkleTree::ComputeNode(size_t Level, size_t Index) const {
+  const vector<license_digest> &children = Levels[Level - 1];
+
+  if (2 * Index + 1 < children.size()) {
+    return ComputeDigest(children[2 * Index], children[2 * Index + 1], NODE_PREFIX);
+  }
+  return children[2 * Index];
+}
+
+/**
+ * @brief
+ * A function to hash all internal nodes of the subtree covering the leaves [FirstLeaf, LastLeaf), up to the level of its root (i.e., log2(Span)).
+ * FirstLeaf shall be aligned to the span of the subtree so that no other subtree shares a node with it.
+ */
+void LicenseMerkleTree::BuildSubtree(size_t FirstLeaf, size_t LastLeaf, size_t Span) {
+  size_t first = FirstLeaf;
+  size_t last = LastLeaf;
+
+  for (size_t level = 1; level < Levels.size() && ((size_t)1 << level) <= Span; level++) {
+    first /= 2;
+    last = (last + 1) / 2;
+    for (size_t i = first; i < last; i++) {
+      Levels[level][i] = ComputeNode(level, i);
+    }
+  }
+}
+
+/**
+ * @brief
+ * A function to hash all internal nodes from the leaves. The subtrees are hashed in parallel, and the few levels above them are hashed afterwards.
+ */
+void LicenseMerkleTree::BuildLevels(int ThreadCount) {
+  if (Levels.empty()) {
+    return;
+  }
+
+  size_t recordCount = Levels[0].size();
+  ThreadCount = ClampThreadCount(ThreadCount, recordCount);
+  size_t span = SubtreeSpan(recordCount, ThreadCount);
+
+  vector<thread> workers;
+  for (size_t first = 0; first < recordCount; first += span) {
+    size_t last = min(first + span, recordCount);
+    workers.push_back(thread(&LicenseMerkleTree::BuildSubtree, this, first, last, span));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  BuildTopLevels(span);
+}
+
+/**
+ * @brief
+ * A function to hash the few levels above the subtree roots, once all subtrees of the given span have been hashed.
+ */
+void LicenseMerkleTree::BuildTopLevels(size_t Span) {
+  size_t subtreeLevel = 0;
+  while (((size_t)1 << subtreeLevel) < Span) {
+    subtreeLevel++;
+  }
+  for (size_t level = subtreeLevel + 1; level < Levels.size(); level++) {
+    for (size_t i = 0; i < Levels[level].size(); i++) {
+      Levels[level][i] = ComputeNode(level, i);
+    }
+  }
+}
+
+/**
+ * @brief
+ * A method to build the tree from all license records of a license store. The records are read and hashed in parallel.
+ *
+ * @param Files
+ * The list of the license records (i.e., the encrypted timestamp file and the checksum file)
+ * @param ThreadCount
+ * The number of threads to read and hash the records
+ * @return OperationState
+ * The operational state of building the tree. It fails if any license record cannot be read.
+ */
+OperationState LicenseMerkleTree::BuildFromFiles(const license_file_list &Files, int ThreadCount) {
+
+  ResizeLevels(Files.size());
+  if (Files.empty()) {
+    return SUCCESS;
+  }
+
+  ThreadCount = ClampThreadCount(ThreadCount, Files.size());
+  size_t span = SubtreeSpan(Files.size(), ThreadCount);
+  size_t subtreeCount = (Files.size() + span - 1) / span;
+  vector<OperationState> states(subtreeCount, SUCCESS);
+  vector<thread> workers;
+
+  for (size_t t = 0; t < subtreeCount; t++) {
+    workers.push_back(thread([this, &Files, &states, span, t]() {
+      size_t first = t * span;
+      size_t last = min(first + span, Files.size());
+      string record;
+
+      for (size_t i = first; i < last; i++) {
+        OperationState state = ReadLicenseRecord(get<0>(Files[i]), get<1>(Files[i]), record);
+        if (state != SUCCESS) {
+          states[t] = state;
+          return;
+        }
+        Levels[0][i] = ComputeLeaf(record);
+      }
+      BuildSubtree(first, last, span);
+    }));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  for (size_t t = 0; t < subtreeCount; t++) {
+    if (states[t] != SUCCESS) {
+      Levels.clear();
+      return states[t];
+    }
+  }
+
+  // the subtrees were built by the worker threads, so only the levels above them are left.
+  BuildTopLevels(span);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A method to verify all license records against the tree in parallel. The tree shall be loaded and checked against the root file (see LoadIndexFile and VerifyRootFile) beforehand.
+ *
+ * @param Files
+ * The list of the license records, in the same order as they were added to the tree
+ * @param TamperedRecords
+ * The indexes of the records which do not match the tree (including the records that cannot be read)
+ * @param ThreadCount
+ * The number of threads to read and hash the records
+ * @return OperationState
+ * SUCCESS if all records match the tree, TIMESTAMP_TAMPERED otherwise.
+ */
+OperationState LicenseMerkleTree::VerifyFiles(const license_file_list &Files, vector<size_t> &TamperedRecords, int ThreadCount) {
+
+  TamperedRecords.clear();
+
+  if (Files.size() != GetRecordCount()) {
+    return INVALID_PARAMETER;
+  }
+  if (Files.empty()) {
+    return SUCCESS;
+  }
+
+  ThreadCount = ClampThreadCount(ThreadCount, Files.size());
+  size_t span = SubtreeSpan(Files.size(), ThreadCount);
+  size_t subtreeCount = (Files.size() + span - 1) / span;
+  vector< vector<size_t> > tampered(subtreeCount);
+  vector<thread> workers;
+
+  for (size_t t = 0; t < subtreeCount; t++) {
+    workers.push_back(thread([this, &Files, &tampered, span, t]() {
+      size_t first = t * span;
+      size_t last = min(first + span, Files.size());
+      string record;
+
+      for (size_t i = first; i < last; i++) {
+        if (ReadLicenseRecord(get<0>(Files[i]), get<1>(Files[i]), record) != SUCCESS || ComputeLeaf(record) != Levels[0][i]) {
+          tampered[t].push_back(i);
+        }
+      }
+    }));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  for (size_t t = 0; t < subtreeCount; t++) {
+    TamperedRecords.insert(TamperedRecords.end(), tampered[t].begin(), tampered[t].end());
+  }
+
+  if (!TamperedRecords.empty()) {
+    if (DEBUG) {
+      cout << TamperedRecords.size() << " license record(s) have been tampered with." << endl;
+    }
+    return TIMESTAMP_TAMPERED;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to rehash the nodes on the path from a leaf to the root, allocating the nodes for a newly appended leaf if needed.
+ */
+void LicenseMerkleTree::RehashPath(size_t Index) {
+  size_t i = Index;
+
+  for (size_t level = 0; Levels[level].size() > 1; level++) {
+    if (Levels.size() == level + 1) {
+      Levels.push_back(vector<license_digest>());
+    }
+    if (Levels[level + 1].size() < (Levels[level].size() + 1) / 2) {
+      Levels[level + 1].resize((Levels[level].size() + 1) / 2);
+    }
+    i /= 2;
+    Levels[level + 1][i] = ComputeNode(level + 1, i);
+  }
+}
+
+/**
+ * @brief
+ * A method to append a new license record (e.g., a newly issued license) to the tree. Only the path from the new leaf to the root is rehashed.
+ *
+ * @param Record
+ * The license record (see ReadLicenseRecord)
+ * @return size_t
+ * The index of the new record in the tree
+ */
+size_t LicenseMerkleTree::AppendRecord(const string &Record) {
+  if (Levels.empty()) {
+    Levels.push_back(vector<license_digest>());
+  }
+
+  Levels[0].push_back(ComputeLeaf(Record));
+  RehashPath(Levels[0].size() - 1);
+
+  return Levels[0].size() - 1;
+}
+
+/**
+ * @brief
+ * A method to update a license record (e.g., a renewed license) in the tree. Only the path from its leaf to the root is rehashed.
+ *
+ * @param Index
+ * The index of the record in the tree
+ * @param Record
+ * The updated license record (see ReadLicenseRecord)
+ * @return OperationState
+ * The operational state of the update
+ */
+OperationState LicenseMerkleTree::UpdateRecord(size_t Index, const string &Record) {
+  if (Index >= GetRecordCount()) {
+    return INVALID_PARAMETER;
+  }
+
+  Levels[0][Index] = ComputeLeaf(Record);
+  RehashPath(Index);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A method to retrieve the proof of a single record, i.e., the sibling hashes on the path from its leaf to the root.
+ * The promoted nodes do not have any sibling, so they do not contribute to the proof.
+ *
+ * @param Index
+ * The index of the record in the tree
+ * @param Proof
+ * The sibling hashes from the bottom to the top of the tree
+ * @return OperationState
+ * The operational state of the proof retrieval
+ */
+OperationState LicenseMerkleTree::GetProof(size_t Index, vector<license_digest> &Proof) const {
+  Proof.clear();
+
+  if (Index >= GetRecordCount()) {
+    return INVALID_PARAMETER;
+  }
+
+  size_t i = Index;
+  for (size_t level = 0; level + 1 < Levels.size(); level++) {
+    size_t sibling = i ^ 1;
+    if (sibling < Levels[level].size()) {
+      Proof.push_back(Levels[level][sibling]);
+    }
+    i /= 2;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to verify a single record against the root with its proof, without the rest of the tree.
+ *
+ * @param Record
+ * The license record (see ReadLicenseRecord)
+ * @param Index
+ * The index of the record in the tree
+ * @param RecordCount
+ * The number of records in the tree when the root was computed
+ * @param Proof
+ * The proof of the record (see GetProof)
+ * @param Root
+ * The trusted root hash (e.g., read from the root file)
+ * @return true
+ * The record matches the root
+ * @return false
+ * The record, the proof or the root has been tampered with
+ */
+bool LicenseMerkleTree::VerifyProof(const string &Record, size_t Index, size_t RecordCount, const vector<license_digest> &Proof, const license_digest &Root) {
+  if (Index >= RecordCount) {
+    return false;
+  }
+
+  license_digest node = ComputeLeaf(Record);
+  size_t i = Index;
+  size_t levelSize = RecordCount;
+  size_t p = 0;
+
+  while (levelSize > 1) {
+    size_t sibling = i ^ 1;
+    if (sibling < levelSize) {
+      if (p >= Proof.size()) {
+        return false;
+      }
+      node = (i & 1) ? ComputeDigest(Proof[p], node, NODE_PREFIX) : ComputeDigest(node, Proof[p], NODE_PREFIX);
+      p++;
+    }
+    i /= 2;
+    levelSize = (levelSize + 1) / 2;
+  }
+
+  return p == Proof.size() && node == Root;
+}
+
+/**
+ * @brief
+ * A method to retrieve the root hash of the tree. The root of an empty tree is the leaf hash of an empty record.
+ */
+license_digest LicenseMerkleTree::GetRoot() const {
+  if (Levels.empty()) {
+    return ComputeLeaf("");
+  }
+  return Levels.back()[0];
+}
+
+size_t LicenseMerkleTree::GetRecordCount() const {
+  return Levels.empty() ? 0 : Levels[0].size();
+}
+
+/**
+ * @brief
+ * A method to write the leaf hashes into the index file. The internal nodes are not stored, as they can be rebuilt in parallel when the index file is loaded.
+ *
+ * @param IndexFileName
+ * The location and file name of the index file
+ * @return OperationState
+ * The operational state of writing the index file
+ */
+OperationState LicenseMerkleTree::WriteIndexFile(const string &IndexFileName) const {
+  if (IndexFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  uint64_t count = GetRecordCount();
+  string content;
+  content.reserve(sizeof(INDEX_MAGIC) + sizeof(INDEX_VERSION) + sizeof(count) + count * DIGEST_SIZE);
+  content.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  content.append((const char *)&INDEX_VERSION, sizeof(INDEX_VERSION));
+  content.append((const char *)&count, sizeof(count));
+  if (count > 0) {
+    content.append((const char *)Levels[0].data(), count * DIGEST_SIZE);
+  }
+
+  // the index file is replaced atomically, so a crash cannot leave it half written (and the tree unloadable).
+  return WriteFileAtomically(IndexFileName, content);
+}
+
+/**
+ * @brief
+ * A method to load the leaf hashes from the index file and rebuild the tree in parallel. The rebuilt tree shall be checked against the root file (see VerifyRootFile).
+ *
+ * @param IndexFileName
+ * The location and file name of the index file
+ * @param ThreadCount
+ * The number of threads to rebuild the tree
+ * @return OperationState
+ * The operational state of loading the index file
+ */
+OperationState LicenseMerkleTree::LoadIndexFile(const string &IndexFileName, int ThreadCount) {
+  if (IndexFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  ifstream indexFile(IndexFileName, ios::binary);
+  if (!indexFile.is_open()) {
+    return FILE_NOT_EXIST;
+  }
+
+  char magic[sizeof(INDEX_MAGIC)];
+  uint32_t version = 0;
+  uint64_t count = 0;
+
+  indexFile.read(magic, sizeof(magic));
+  indexFile.read((char *)&version, sizeof(version));
+  indexFile.read((char *)&count, sizeof(count));
+  if (!indexFile || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 || version != INDEX_VERSION) {
+    cout << "Malformed index file, " << IndexFileName << endl;
+    return INTEGRITY_ROOT_MISMATCH;
+  }
+
+  // the leaf count is checked against the file size before anything is allocated for it, so a truncated or corrupted index file is rejected as it is.
+  uint64_t headerSize = sizeof(magic) + sizeof(version) + sizeof(count);
+  indexFile.seekg(0, ios::end);
+  uint64_t fileSize = (uint64_t)indexFile.tellg();
+  if (!indexFile || fileSize < headerSize || (fileSize - headerSize) % DIGEST_SIZE != 0 || count != (fileSize - headerSize) / DIGEST_SIZE) {
+    cout << "Malformed index file, " << IndexFileName << endl;
+    return INTEGRITY_ROOT_MISMATCH;
+  }
+  indexFile.seekg(headerSize, ios::beg);
+
+  ResizeLevels(count);
+  if (count > 0) {
+    indexFile.read((char *)Levels[0].data(), count * DIGEST_SIZE);
+    if (!indexFile) {
+      Levels.clear();
+      cout << "Malformed index file, " << IndexFileName << endl;
+      return INTEGRITY_ROOT_MISMATCH;
+    }
+  }
+  indexFile.close();
+
+  BuildLevels(ThreadCount);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A method to write the root hash and the record count into the root file. The root file shall be stored separately from the license store and the index file.
+ *
+ * @param RootFileName
+ * The location and file name of the root file
+ * @return OperationState
+ * The operational state of writing the root file
+ */
+OperationState LicenseMerkleTree::WriteRootFile(const string &RootFileName) const {
+  if (RootFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  ostringstream root;
+  root << DigestToString(GetRoot()) << " " << GetRecordCount() << endl;
+
+  return WriteFileAtomically(RootFileName, root.str());
+}
+
+/**
+ * @brief
+ * A method to check the tree against the root file.
+ *
+ * @param RootFileName
+ * The location and file name of the root file
+ * @return OperationState
+ * SUCCESS if the root hash and the record count match the root file, INTEGRITY_ROOT_MISMATCH otherwise.
+ */
+OperationState LicenseMerkleTree::VerifyRootFile(const string &RootFileName) const {
+  if (RootFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  ifstream rootFile(RootFileName);
+  if (!rootFile.is_open()) {
+    return FILE_NOT_EXIST;
+  }
+
+  string hex = "";
+  size_t count = 0;
+  license_digest root;
+
+  rootFile >> hex >> count;
+  rootFile.close();
+
+  if (!StringToDigest(hex, root) || root != GetRoot() || count != GetRecordCount()) {
+    cout << "calculated root: " << DigestToString(GetRoot()) << ", read root: " << hex << endl;
+    cout << "mismatched root. The license store or its index has been tampered with." << endl;
+    return INTEGRITY_ROOT_MISMATCH;
+  }
+
+  return SUCCESS;
+}
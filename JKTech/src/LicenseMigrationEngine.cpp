@@ -0,0 +1,428 @@
+/**
+ * @file LicenseMigrationEngine.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The migration engine to re-encrypt all license pairs on a host, e.g., when the licenses move to a new key schedule.
+ *
+ * The license pairs stream through the discover -> decrypt -> re-encrypt -> durable write stages, which are connected by bounded queues,
+ * so the memory usage is bounded by the queue capacities (and a 64-bit key of each license done in the journal, until it is discovered again), not by the number of license files.
+ * The progress, the throughput and the peak memory usage are reported once per second while the migration runs.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseMigrationEngine.h"
+#include "../include/LicenseDigest.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief
+ * The interval (in seconds) between two progress reports.
+ */
+const int PROGRESS_INTERVAL = 1;
+
+/**
+ * @brief
+ * A function to retrieve the peak resident memory of the process (in kilobytes).
+ */
+static long GetPeakResidentKiloBytes() {
+  struct rusage usage;
+  return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+/**
+ * @brief Construct a new License Migration Engine:: License Migration Engine object
+ *
+ * @param SourceSchedule
+ * The key schedule all the licenses are encrypted with. An empty key schedule is the default one.
+ * @param TargetSchedule
+ * The key schedule all the licenses are re-encrypted with. An empty key schedule is the default one.
+ * @param ThreadCount
+ * The number of worker threads of each of the decrypt, re-encrypt and write stages
+ * @param QueueCapacity
+ * The capacity of each queue between two stages
+ * @param EncryptedSuffix
+ * The suffix of the encrypted timestamp file names
+ * @param CheckSumSuffix
+ * The suffix of the checksum file names. The checksum file of "<prefix><EncryptedSuffix>" is "<prefix><CheckSumSuffix>" in the same directory.
+ */
+LicenseMigrationEngine::LicenseMigrationEngine(const prime_list &SourceSchedule, const prime_list &TargetSchedule, int ThreadCount, size_t QueueCapacity,
+                                               string EncryptedSuffix, string CheckSumSuffix)
+  : LicenseMigrationEngine([SourceSchedule](const string &, license_id, prime_list &KeySchedule) { KeySchedule = SourceSchedule; return SUCCESS; },
+                           nullptr, TargetSchedule, nullptr, ThreadCount, QueueCapacity, EncryptedSuffix, CheckSumSuffix) {
+}
+
+/**
+ * @brief Construct a new License Migration Engine:: License Migration Engine object
+ *
+ * @param SourceLookup
+ * The lookup of the key schedule each license is encrypted with (see key_schedule_lookup)
+ * @param SourcePool
+ * The prime pool the key schedules of the licenses with stored prime pool indexes were drawn from, or nullptr (which fails those licenses). It shall outlive the engine.
+ * @param TargetSchedule
+ * The key schedule the licenses are re-encrypted with, if there is no target pool. An empty key schedule is the default one.
+ * @param TargetPool
+ * The prime pool to draw the key schedule of each re-encrypted license from, or nullptr. It shall outlive the engine.
+ * @param ThreadCount
+ * The number of worker threads of each of the decrypt, re-encrypt and write stages
+ * @param QueueCapacity
+ * The capacity of each queue between two stages
+ * @param EncryptedSuffix
+ * The suffix of the encrypted timestamp file names
+ * @param CheckSumSuffix
+ * The suffix of the checksum file names. The checksum file of "<prefix><EncryptedSuffix>" is "<prefix><CheckSumSuffix>" in the same directory.
+ */
+LicenseMigrationEngine::LicenseMigrationEngine(const key_schedule_lookup &SourceLookup, const LicensePrimePool *SourcePool, const prime_list &TargetSchedule,
+                                               const LicensePrimePool *TargetPool, int ThreadCount, size_t QueueCapacity, string EncryptedSuffix, string CheckSumSuffix)
+  : SourceLookup(SourceLookup), SourcePool(SourcePool), TargetSchedule(TargetSchedule), TargetPool(TargetPool), ThreadCount(ThreadCount < 1 ? 1 : ThreadCount),
+    EncryptedSuffix(EncryptedSuffix), CheckSumSuffix(CheckSumSuffix),
+    DiscoveredQueue(QueueCapacity < 1 ? 1 : QueueCapacity), DecryptedQueue(QueueCapacity < 1 ? 1 : QueueCapacity), EncryptedQueue(QueueCapacity < 1 ? 1 : QueueCapacity),
+    ActiveDecryptWorkers(0), ActiveEncryptWorkers(0), JournalDescriptor(-1),
+    PairsDiscovered(0), PairsMigrated(0), PairsSkipped(0), PairsResumed(0), PairsFailed(0), Seconds(0) {
+}
+
+/**
+ * @brief
+ * An API to migrate all license pairs under the given directory trees. An engine runs a single migration.
+ *
+ * @param RootDirectories
+ * The roots of the directory trees to migrate
+ * @param JournalFileName
+ * The location and file name of the checkpoint journal. If it exists, the migration is resumed from it.
+ * @param Progress
+ * The stream to report the progress to once per second, or nullptr
+ * @return OperationState
+ * The operational state of the migration. The licenses which fail to be migrated are counted in the statistics, and do not fail the migration.
+ */
+OperationState LicenseMigrationEngine::Run(const vector<string> &RootDirectories, const string &JournalFileName, ostream *Progress) {
+  OperationState ret = SUCCESS;
+
+  if (RootDirectories.empty() || JournalFileName.empty() || !SourceLookup || EncryptedSuffix.empty() || CheckSumSuffix.empty() || JournalDescriptor >= 0) {
+    return INVALID_PARAMETER;
+  }
+
+  steady_clock::time_point start = steady_clock::now();
+
+  if ((ret = ResumeJournal(JournalFileName)) != SUCCESS) {
+    if (JournalDescriptor >= 0) {
+      close(JournalDescriptor);
+    }
+    return ret;
+  }
+
+  ActiveDecryptWorkers = ThreadCount;
+  ActiveEncryptWorkers = ThreadCount;
+
+  vector<thread> workers;
+  for (int i = 0; i < ThreadCount; i++) {
+    workers.push_back(thread(&LicenseMigrationEngine::RunDecryptWorker, this));
+    workers.push_back(thread(&LicenseMigrationEngine::RunEncryptWorker, this));
+    workers.push_back(thread(&LicenseMigrationEngine::RunWriteWorker, this));
+  }
+
+  mutex reporterMutex;
+  condition_variable reporterCondition;
+  bool finished = false;
+  thread reporter;
+  if (Progress != nullptr) {
+    reporter = thread([&]() {
+      unique_lock<mutex> lock(reporterMutex);
+      while (!reporterCondition.wait_for(lock, seconds(PROGRESS_INTERVAL), [&] { return finished; })) {
+        ReportProgress(*Progress, duration<double>(steady_clock::now() - start).count());
+      }
+    });
+  }
+
+  DiscoverPairs(RootDirectories);
+  DiscoveredQueue.Close();
+  // the licenses done which were not discovered again (e.g., removed since) are not needed any more.
+  unordered_set<uint64_t>().swap(CompletedFiles);
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  if (reporter.joinable()) {
+    {
+      lock_guard<mutex> lock(reporterMutex);
+      finished = true;
+    }
+    reporterCondition.notify_all();
+    reporter.join();
+  }
+
+  Seconds = duration<double>(steady_clock::now() - start).count();
+  if (Progress != nullptr) {
+    ReportProgress(*Progress, Seconds);
+  }
+
+  if (fsync(JournalDescriptor) != 0) {
+    ret = FILE_FAIL_OPEN;
+  }
+  close(JournalDescriptor);
+
+  return ret;
+}
+
+/**
+ * @brief
+ * A function to read the checkpoint journal of an interrupted migration (if any). The licenses done are skipped by this run,
+ * and the replacements pending are completed from their staged files, without decrypting the licenses again.
+ */
+OperationState LicenseMigrationEngine::ResumeJournal(const string &JournalFileName) {
+  JournalDescriptor = open(JournalFileName.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (JournalDescriptor < 0) {
+    cout << "Unable to open file, " << JournalFileName << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  // the pending replacements are kept by name to be completed, and are few (at most one per write worker of each interrupted run).
+  unordered_set<string> pending;
+  string line;
+  char buffer[64 * 1024];
+  ssize_t bytes;
+
+  while ((bytes = read(JournalDescriptor, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t i = 0; i < bytes; i++) {
+      if (buffer[i] != '\n') {
+        line += buffer[i];
+        continue;
+      }
+      if (line.length() > 2 && line[0] == 'P') {
+        pending.insert(line.substr(2));
+      } else if (line.length() > 2 && line[0] == 'D') {
+        pending.erase(line.substr(2));
+        CompletedFiles.insert(GetFileKey(line.substr(2)));
+      }
+      line.clear();
+    }
+  }
+  // a record without its line break was torn by a crash; it is terminated so that the next record starts on its own line.
+  if (!line.empty() && write(JournalDescriptor, "\n", 1) != 1) {
+    return FILE_FAIL_OPEN;
+  }
+
+  LicensePairScanner scanner(EncryptedSuffix, CheckSumSuffix);
+  for (unordered_set<string>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+    const string &encryptionFileName = *it;
+    LicenseTimeStampOperation target(encryptionFileName, scanner.GetCheckSumFileName(encryptionFileName), 0, TargetSchedule);
+
+    if (!scanner.IsEncryptionFileName(encryptionFileName) || target.CommitTimeStampFile() != SUCCESS || AppendJournal('D', encryptionFileName, false) != SUCCESS) {
+      cout << "Unable to resume the migration of " << encryptionFileName << endl;
+      PairsFailed++;
+    } else {
+      PairsResumed++;
+    }
+    CompletedFiles.insert(GetFileKey(encryptionFileName));
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to derive the key of a license done from its encrypted timestamp file, i.e., the first 8 bytes of the SHA-256 digest of the file name.
+ * The keys of the licenses done take 8 bytes each, whatever the length of their paths.
+ */
+uint64_t LicenseMigrationEngine::GetFileKey(const string &EncryptionFileName) {
+  license_digest digest = ComputeDigest(EncryptionFileName.data(), EncryptionFileName.length());
+  uint64_t key = 0;
+
+  for (int i = 0; i < 8; i++) {
+    key = (key << 8) | digest[i];
+  }
+  return key;
+}
+
+/**
+ * @brief
+ * A function to append a record to the checkpoint journal. The record is a single write, so the records of concurrent writers cannot interleave.
+ *
+ * @param Record
+ * 'P' before the staged files replace the original ones, and 'D' after
+ * @param EncryptionFileName
+ * The encrypted timestamp file of the license
+ * @param Durable
+ * Whether the record shall be flushed to the disk before returning
+ */
+OperationState LicenseMigrationEngine::AppendJournal(char Record, const string &EncryptionFileName, bool Durable) {
+  string line = string(1, Record) + " " + EncryptionFileName + "\n";
+
+  if (write(JournalDescriptor, line.data(), line.length()) != (ssize_t)line.length()) {
+    return FILE_FAIL_OPEN;
+  }
+  if (Durable && fdatasync(JournalDescriptor) != 0) {
+    return FILE_FAIL_OPEN;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * The discover stage, which walks the directory trees and feeds the license pairs to the decrypt stage. It blocks while the decrypt stage is behind.
+ */
+void LicenseMigrationEngine::DiscoverPairs(const vector<string> &RootDirectories) {
+  vector<string> directories(RootDirectories.rbegin(), RootDirectories.rend());
+  LicensePairScanner scanner(EncryptedSuffix, CheckSumSuffix);
+  LicensePairBatch batch;
+
+  while (!directories.empty()) {
+    string directory = directories.back();
+    directories.pop_back();
+
+    if (scanner.Open(directory) != SUCCESS) {
+      continue;
+    }
+
+    while (scanner.ReadBatch(batch)) {
+      directories.insert(directories.end(), batch.Subdirectories.begin(), batch.Subdirectories.end());
+
+      for (size_t i = 0; i < batch.Pairs.size(); i++) {
+        if (!batch.Pairs[i].Paired) {
+          continue;
+        }
+        PairsDiscovered++;
+
+        // a license is discovered once, so its key is dropped once it is skipped.
+        if (!CompletedFiles.empty() && CompletedFiles.erase(GetFileKey(batch.Pairs[i].EncryptionFileName)) != 0) {
+          PairsSkipped++;
+          continue;
+        }
+
+        MigrationItem item;
+        item.EncryptionFileName = batch.Pairs[i].EncryptionFileName;
+        item.CheckSumFileName = batch.Pairs[i].CheckSumFileName;
+        item.Length = 0;
+        item.Serial = 0;
+        DiscoveredQueue.Push(move(item));
+      }
+    }
+  }
+}
+
+/**
+ * @brief
+ * The decrypt stage, which decrypts each license with its source key schedule, looked up from its identity (or from its stored indexes in the source pool).
+ */
+void LicenseMigrationEngine::RunDecryptWorker() {
+  MigrationItem item;
+
+  while (DiscoveredQueue.Pop(item)) {
+    // the identity does not depend on the key schedule, and the license keeps it when it is re-encrypted.
+    LicenseTimeStampOperation license(item.EncryptionFileName, item.CheckSumFileName, 0);
+    prime_list sourceSchedule;
+
+    if (license.GetLicenseId(item.Serial) != SUCCESS || SourceLookup(item.EncryptionFileName, item.Serial, sourceSchedule) != SUCCESS) {
+      PairsFailed++;
+      continue;
+    }
+
+    LicenseTimeStampOperation source(item.EncryptionFileName, item.CheckSumFileName, 0, sourceSchedule, SourcePool);
+    if (source.InspectTimeStamp(item.TimeStamp) != SUCCESS || !LicenseTimeStampOperation::IsWellFormedTimeStamp(item.TimeStamp)) {
+      PairsFailed++;
+      continue;
+    }
+    DecryptedQueue.Push(move(item));
+  }
+
+  if (--ActiveDecryptWorkers == 0) {
+    DecryptedQueue.Close();
+  }
+}
+
+/**
+ * @brief
+ * The re-encrypt stage, which encrypts the decrypted timestamp of each license with the target key schedule (or a key schedule drawn from the target pool).
+ */
+void LicenseMigrationEngine::RunEncryptWorker() {
+  MigrationItem item;
+
+  while (DecryptedQueue.Pop(item)) {
+    LicenseTimeStampOperation target(item.EncryptionFileName, item.CheckSumFileName, 0, TargetSchedule, TargetPool);
+
+    if (target.EncryptTimeStamp(item.TimeStamp, item.Serial, item.EncryptedOut, item.CheckSum, item.KeyIndexes, item.Length) != SUCCESS) {
+      PairsFailed++;
+      continue;
+    }
+    EncryptedQueue.Push(move(item));
+  }
+
+  if (--ActiveEncryptWorkers == 0) {
+    EncryptedQueue.Close();
+  }
+}
+
+/**
+ * @brief
+ * The durable write stage, which replaces each license pair through its staged files.
+ * The pending record is flushed to the journal before the original files are replaced, so that a crash in between is completed on resume instead of decrypting the license again.
+ */
+void LicenseMigrationEngine::RunWriteWorker() {
+  MigrationItem item;
+
+  while (EncryptedQueue.Pop(item)) {
+    LicenseTimeStampOperation target(item.EncryptionFileName, item.CheckSumFileName, 0, TargetSchedule);
+
+    if (target.StageTimeStampFile(item.EncryptedOut, item.CheckSum, item.Serial, item.KeyIndexes, item.Length) != SUCCESS) {
+      string staged[2] = {item.EncryptionFileName + STAGED_FILE_SUFFIX, item.CheckSumFileName + STAGED_FILE_SUFFIX};
+      unlink(staged[0].c_str());
+      unlink(staged[1].c_str());
+      PairsFailed++;
+      continue;
+    }
+
+    if (AppendJournal('P', item.EncryptionFileName, true) != SUCCESS || target.CommitTimeStampFile() != SUCCESS ||
+        AppendJournal('D', item.EncryptionFileName, false) != SUCCESS) {
+      cout << "Unable to complete the migration of " << item.EncryptionFileName << endl;
+      PairsFailed++;
+      continue;
+    }
+    PairsMigrated++;
+  }
+}
+
+/**
+ * @brief
+ * A function to report the progress, the throughput, the queue depths and the peak memory usage of the migration.
+ */
+void LicenseMigrationEngine::ReportProgress(ostream &Progress, double Elapsed) {
+  unsigned long migrated = PairsMigrated;
+
+  Progress << fixed << setprecision(1) << "[" << Elapsed << "s] discovered " << PairsDiscovered << ", migrated " << migrated
+           << " (" << setprecision(0) << (Elapsed > 0 ? migrated / Elapsed : 0) << "/s), skipped " << PairsSkipped << ", resumed " << PairsResumed
+           << ", failed " << PairsFailed << ", queued " << DiscoveredQueue.GetSize() << "/" << DecryptedQueue.GetSize() << "/" << EncryptedQueue.GetSize()
+           << ", peak RSS " << setprecision(1) << GetPeakResidentKiloBytes() / 1024.0 << " MB" << endl;
+}
+
+/**
+ * @brief
+ * A method to retrieve the statistics of the migration run.
+ */
+LicenseMigrationStatistics LicenseMigrationEngine::GetStatistics() const {
+  LicenseMigrationStatistics statistics;
+
+  statistics.PairsDiscovered = PairsDiscovered;
+  statistics.PairsMigrated = PairsMigrated;
+  statistics.PairsSkipped = PairsSkipped;
+  statistics.PairsResumed = PairsResumed;
+  statistics.PairsFailed = PairsFailed;
+  statistics.Seconds = Seconds;
+  statistics.PeakResidentKiloBytes = GetPeakResidentKiloBytes();
+
+  return statistics;
+}
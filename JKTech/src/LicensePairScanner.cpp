@@ -0,0 +1,201 @@
+/**
+ * @file LicensePairScanner.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The scanner of the license pairs in a directory, i.e., the encrypted timestamp files with their checksum files.
+ *
+ * The directory entries are read in large batches with getdents64, and the checksum files of a batch are looked up with fstatat relative to the open directory,
+ * so that a walk over millions of license files neither resolves their paths nor stats the entries which are not license files.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicensePairScanner.h"
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The directory entry returned by getdents64 (see getdents64(2)).
+ */
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/**
+ * @brief
+ * A function to check if a string ends with the given suffix.
+ */
+static bool EndsWith(const char *name, size_t length, const string &suffix) {
+  return length >= suffix.length() && memcmp(name + length - suffix.length(), suffix.data(), suffix.length()) == 0;
+}
+
+/**
+ * @brief Construct a new License Pair Scanner:: License Pair Scanner object
+ *
+ * @param EncryptedSuffix
+ * The suffix of the encrypted timestamp file names
+ * @param CheckSumSuffix
+ * The suffix of the checksum file names. The checksum file of "<prefix><EncryptedSuffix>" is "<prefix><CheckSumSuffix>" in the same directory.
+ */
+LicensePairScanner::LicensePairScanner(const string &EncryptedSuffix, const string &CheckSumSuffix)
+  : EncryptedSuffix(EncryptedSuffix), CheckSumSuffix(CheckSumSuffix), DirectoryDescriptor(-1) {
+}
+
+LicensePairScanner::~LicensePairScanner() {
+  Close();
+}
+
+/**
+ * @brief
+ * A method to open a directory to be scanned. The previously opened directory, if any, is closed.
+ *
+ * @param Directory
+ * The directory to be scanned
+ * @return OperationState
+ * The operational state of opening the directory
+ */
+OperationState LicensePairScanner::Open(const string &Directory) {
+  Close();
+
+  if (Directory.empty() || EncryptedSuffix.empty() || CheckSumSuffix.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  DirectoryDescriptor = open(Directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (DirectoryDescriptor < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  Prefix = Directory[Directory.length() - 1] == '/' ? Directory : Directory + "/";
+  Buffer.resize(DIRECTORY_BATCH_SIZE);
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A method to read the next batch of entries of the open directory.
+ *
+ * @param Batch
+ * The subdirectories and the license pairs of the batch (cleared first)
+ * @return true
+ * It means that a batch has been read
+ * @return false
+ * It means that the directory has been read to the end (or cannot be read any more), and it is closed
+ */
+bool LicensePairScanner::ReadBatch(LicensePairBatch &Batch) {
+  Batch.Subdirectories.clear();
+  Batch.Pairs.clear();
+  Batch.RegularFiles = 0;
+  Batch.CheckSumFiles = 0;
+
+  if (DirectoryDescriptor < 0) {
+    return false;
+  }
+
+  long bytes = syscall(SYS_getdents64, DirectoryDescriptor, Buffer.data(), Buffer.size());
+  if (bytes <= 0) {
+    Close();
+    return false;
+  }
+
+  for (long offset = 0; offset < bytes; ) {
+    const LinuxDirent64 *entry = (const LinuxDirent64 *)(Buffer.data() + offset);
+    offset += entry->d_reclen;
+
+    const char *name = entry->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+
+    unsigned char type = entry->d_type;
+    // only the file systems without the entry type in their directory entries need a stat call.
+    if (type == DT_UNKNOWN) {
+      struct stat status;
+      if (fstatat(DirectoryDescriptor, name, &status, AT_SYMLINK_NOFOLLOW) != 0) {
+        continue;
+      }
+      type = S_ISDIR(status.st_mode) ? DT_DIR : (S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN);
+    }
+
+    if (type == DT_DIR) {
+      Batch.Subdirectories.push_back(Prefix + name);
+    } else if (type == DT_REG) {
+      size_t length = strlen(name);
+      Batch.RegularFiles++;
+      if (EndsWith(name, length, EncryptedSuffix)) {
+        LicensePair pair;
+        pair.EncryptionFileName = string(name, length - EncryptedSuffix.length());
+        pair.Paired = false;
+        Batch.Pairs.push_back(pair);
+      } else if (EndsWith(name, length, CheckSumSuffix)) {
+        Batch.CheckSumFiles++;
+      }
+    }
+  }
+
+  // the checksum files of this batch are looked up relative to the open directory.
+  for (size_t i = 0; i < Batch.Pairs.size(); i++) {
+    LicensePair &pair = Batch.Pairs[i];
+    string checksumName = pair.EncryptionFileName + CheckSumSuffix;
+    struct stat status;
+
+    pair.Paired = fstatat(DirectoryDescriptor, checksumName.c_str(), &status, 0) == 0 && S_ISREG(status.st_mode);
+    pair.CheckSumFileName = Prefix + checksumName;
+    pair.EncryptionFileName = Prefix + pair.EncryptionFileName + EncryptedSuffix;
+  }
+
+  return true;
+}
+
+/**
+ * @brief
+ * A method to close the open directory, if any.
+ */
+void LicensePairScanner::Close() {
+  if (DirectoryDescriptor >= 0) {
+    close(DirectoryDescriptor);
+  }
+  DirectoryDescriptor = -1;
+}
+
+/**
+ * @brief
+ * A method to check if a file name is the name of an encrypted timestamp file (i.e., it ends with the encrypted suffix).
+ */
+bool LicensePairScanner::IsEncryptionFileName(const string &FileName) const {
+  return EndsWith(FileName.data(), FileName.length(), EncryptedSuffix);
+}
+
+/**
+ * @brief
+ * A method to derive the checksum file name of an encrypted timestamp file ("<prefix><encrypted suffix>" -> "<prefix><checksum suffix>").
+ *
+ * @param EncryptionFileName
+ * The encrypted timestamp file name (see IsEncryptionFileName)
+ * @return string
+ * The checksum file name, or an empty string if the file name is not the name of an encrypted timestamp file
+ */
+string LicensePairScanner::GetCheckSumFileName(const string &EncryptionFileName) const {
+  if (!IsEncryptionFileName(EncryptionFileName)) {
+    return "";
+  }
+  return EncryptionFileName.substr(0, EncryptionFileName.length() - EncryptedSuffix.length()) + CheckSumSuffix;
+}
@@ -0,0 +1,430 @@
+/**
+ * @file LicensePrimePool.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The prime pool for the per-license key randomization.
+ *
+ * Generating primes when a license is issued would make the issuance much slower with large primes. Instead, a large pool of primes is built offline
+ * (a sieve over random windows plus the Miller-Rabin test), stored in a compact table file, and memory-mapped by the issuer. Drawing a key schedule is then a few random indexes into the table.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicensePrimePool.h"
+#include <iostream>
+#include <random>
+#include <unordered_set>
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The header of the prime pool file.
+ */
+struct PrimePoolFileHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint32_t Bits;
+  uint32_t Reserved;
+  uint64_t Count;
+};
+
+const char PRIME_POOL_MAGIC[4] = {'L', 'P', 'P', 'L'};
+const uint32_t PRIME_POOL_VERSION = 1;
+
+/**
+ * @brief
+ * The number of consecutive sieve windows without any new prime before building the prime pool gives up (i.e., there are not enough primes of the given size).
+ */
+const int MAX_IDLE_WINDOWS = 1000;
+
+/**
+ * @brief
+ * The bases of the Miller-Rabin test, which make the test deterministic for all 64-bit integers.
+ */
+static const uint64_t MillerRabinBases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+static inline uint64_t MultiplyMod(uint64_t a, uint64_t b, uint64_t m) {
+  return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+static uint64_t PowerMod(uint64_t base, uint64_t exponent, uint64_t m) {
+  uint64_t result = 1;
+  base %= m;
+  while (exponent > 0) {
+    if (exponent & 1) {
+      result = MultiplyMod(result, base, m);
+    }
+    base = MultiplyMod(base, base, m);
+    exponent >>= 1;
+  }
+  return result;
+}
+
+/**
+ * @brief
+ * A function to check if a 64-bit integer is a prime, with the deterministic Miller-Rabin test.
+ *
+ * @param n
+ * The integer to be checked
+ * @return true
+ * @n is a prime
+ * @return false
+ * @n is not a prime
+ */
+bool LicensePrimePool::IsPrime(uint64_t n) {
+  if (n < 2) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(MillerRabinBases) / sizeof(MillerRabinBases[0]); i++) {
+    if (n % MillerRabinBases[i] == 0) {
+      return n == MillerRabinBases[i];
+    }
+  }
+
+  // n - 1 = d * 2^r with an odd d
+  uint64_t d = n - 1;
+  int r = 0;
+  while ((d & 1) == 0) {
+    d >>= 1;
+    r++;
+  }
+
+  for (size_t i = 0; i < sizeof(MillerRabinBases) / sizeof(MillerRabinBases[0]); i++) {
+    uint64_t x = PowerMod(MillerRabinBases[i], d, n);
+    if (x == 1 || x == n - 1) {
+      continue;
+    }
+    bool composite = true;
+    for (int j = 1; j < r; j++) {
+      x = MultiplyMod(x, x, n);
+      if (x == n - 1) {
+        composite = false;
+        break;
+      }
+    }
+    if (composite) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief
+ * A function to list the small primes (up to @Limit) with the sieve of Eratosthenes. They are used to sieve the windows of candidates.
+ */
+static vector<uint32_t> SmallPrimes(uint32_t Limit) {
+  vector<bool> composite(Limit + 1, false);
+  vector<uint32_t> primes;
+
+  for (uint32_t i = 3; i <= Limit; i += 2) {
+    if (composite[i]) {
+      continue;
+    }
+    primes.push_back(i);
+    for (uint64_t j = (uint64_t)i * i; j <= Limit; j += 2 * i) {
+      composite[j] = true;
+    }
+  }
+  return primes;
+}
+
+/**
+ * @brief
+ * A method to build the prime pool file offline.
+ *
+ * Random windows of odd numbers with the given size (in bits) are sieved with the small primes, and the survivors are confirmed with the Miller-Rabin test.
+ * The file is replaced atomically (see WriteFileAtomically).
+ *
+ * @param PrimePoolFileName
+ * The location and file name of the prime pool file
+ * @param PrimeCount
+ * The number of distinct primes in the pool
+ * @param PrimeBits
+ * The size of each prime (in bits), from 8 to 64
+ * @return OperationState
+ * The operational state of building the prime pool file
+ */
+OperationState LicensePrimePool::BuildPrimePoolFile(const string &PrimePoolFileName, size_t PrimeCount, int PrimeBits) {
+  if (PrimePoolFileName.empty() || PrimeCount < 2 || PrimeBits < 8 || PrimeBits > 64) {
+    return INVALID_PARAMETER;
+  }
+
+  uint64_t low = (uint64_t)1 << (PrimeBits - 1);
+  uint64_t high = PrimeBits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << PrimeBits) - 1;
+  uint64_t oddCount = (high - low) / 2 + 1;
+  uint64_t window = oddCount < (uint64_t)SIEVE_WINDOW ? oddCount : SIEVE_WINDOW;
+
+  // the small primes up to 2^16 remove about 90% of the odd candidates before the Miller-Rabin test.
+  vector<uint32_t> smallPrimes = SmallPrimes(PrimeBits > 32 ? 65536 : min<uint64_t>(65536, (uint64_t)1 << (PrimeBits / 2 + 1)));
+
+  random_device device;
+  mt19937_64 random(((uint64_t)device() << 32) ^ device());
+  uniform_int_distribution<uint64_t> startDistribution(0, oddCount - window);
+
+  unordered_set<uint64_t> found;
+  vector<uint64_t> primes;
+  vector<bool> sieved(window);
+  int idleWindows = 0;
+
+  while (primes.size() < PrimeCount) {
+    // the window holds the odd numbers start, start + 2, ..., start + 2 * (window - 1)
+    uint64_t start = low + 2 * startDistribution(random) + (low & 1 ? 0 : 1);
+    size_t before = primes.size();
+
+    fill(sieved.begin(), sieved.end(), false);
+    for (size_t i = 0; i < smallPrimes.size(); i++) {
+      uint64_t q = smallPrimes[i];
+      if (q * q > start + 2 * (window - 1)) {
+        break;
+      }
+      uint64_t first = (start + q - 1) / q * q;
+      if ((first & 1) == 0) {
+        first += q;
+      }
+      if (first < q * q) {
+        first = q * q;
+      }
+      for (uint64_t j = (first - start) / 2; j < window; j += q) {
+        sieved[j] = true;
+      }
+    }
+
+    for (uint64_t j = 0; j < window && primes.size() < PrimeCount; j++) {
+      uint64_t candidate = start + 2 * j;
+      if (!sieved[j] && IsPrime(candidate) && found.insert(candidate).second) {
+        primes.push_back(candidate);
+      }
+    }
+
+    idleWindows = primes.size() == before ? idleWindows + 1 : 0;
+    if (idleWindows >= MAX_IDLE_WINDOWS) {
+      cout << "There are not enough " << PrimeBits << "-bit primes for a pool of " << PrimeCount << " primes." << endl;
+      return INVALID_PARAMETER;
+    }
+  }
+
+  // the primes in a window are consecutive, so they are shuffled to make the neighbouring entries of the table unrelated.
+  shuffle(primes.begin(), primes.end(), random);
+
+  PrimePoolFileHeader header;
+  memcpy(header.Magic, PRIME_POOL_MAGIC, sizeof(header.Magic));
+  header.Version = PRIME_POOL_VERSION;
+  header.Bits = PrimeBits;
+  header.Reserved = 0;
+  header.Count = primes.size();
+
+  string content((const char *)&header, sizeof(header));
+  content.append((const char *)primes.data(), primes.size() * sizeof(uint64_t));
+
+  // the pool file is replaced atomically, as the licenses issued from it can only be inspected with the same pool.
+  return WriteFileAtomically(PrimePoolFileName, content);
+}
+
+LicensePrimePool::LicensePrimePool()
+  : Mapping(nullptr), MappingLength(0), Primes(nullptr), PrimeCount(0), PrimeBits(0) {
+}
+
+LicensePrimePool::~LicensePrimePool() {
+  Unload();
+}
+
+/**
+ * @brief
+ * A function to release the memory mapping of the current prime pool file.
+ */
+void LicensePrimePool::Unload() {
+  if (Mapping != nullptr) {
+    munmap(Mapping, MappingLength);
+  }
+  Mapping = nullptr;
+  MappingLength = 0;
+  Primes = nullptr;
+  PrimeCount = 0;
+  PrimeBits = 0;
+}
+
+/**
+ * @brief
+ * A method to load (i.e., memory-map) the prime pool file. The previously loaded prime pool, if any, is released.
+ *
+ * @param PrimePoolFileName
+ * The location and file name of the prime pool file
+ * @return OperationState
+ * The operational state of loading the prime pool file
+ */
+OperationState LicensePrimePool::LoadPrimePoolFile(const string &PrimePoolFileName) {
+  Unload();
+
+  if (PrimePoolFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  int fd = open(PrimePoolFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  struct stat buffer;
+  if (fstat(fd, &buffer) != 0 || (size_t)buffer.st_size < sizeof(PrimePoolFileHeader)) {
+    close(fd);
+    cout << "Malformed prime pool file, " << PrimePoolFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  MappingLength = buffer.st_size;
+  Mapping = mmap(nullptr, MappingLength, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (Mapping == MAP_FAILED) {
+    Mapping = nullptr;
+    MappingLength = 0;
+    return FILE_FAIL_OPEN;
+  }
+
+  const PrimePoolFileHeader *header = (const PrimePoolFileHeader *)Mapping;
+  if (memcmp(header->Magic, PRIME_POOL_MAGIC, sizeof(header->Magic)) != 0 || header->Version != PRIME_POOL_VERSION || header->Count < 2 ||
+      (MappingLength - sizeof(PrimePoolFileHeader)) % sizeof(uint64_t) != 0 || header->Count != (MappingLength - sizeof(PrimePoolFileHeader)) / sizeof(uint64_t)) {
+    Unload();
+    cout << "Malformed prime pool file, " << PrimePoolFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  Primes = (const uint64_t *)((const char *)Mapping + sizeof(PrimePoolFileHeader));
+  PrimeCount = header->Count;
+  PrimeBits = header->Bits;
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to draw uniform random indexes from the kernel random number generator (getrandom).
+ *
+ * The random words are read in batches of up to 256 bytes, which getrandom returns in full. A word at or above the largest multiple of the bound is rejected,
+ * so that the indexes are not biased towards the low end.
+ *
+ * @param Bound
+ * The number of possible indexes (i.e., the indexes are in 0 .. Bound - 1)
+ * @param Indexes
+ * The drawn indexes
+ * @param Count
+ * The number of indexes to draw
+ * @return true
+ * It means that the indexes have been drawn
+ * @return false
+ * It means that the kernel random number generator is not available
+ */
+static bool DrawRandomIndexes(uint64_t Bound, uint32_t *Indexes, size_t Count) {
+  uint64_t words[32];
+  uint64_t limit = UINT64_MAX - UINT64_MAX % Bound;
+  size_t drawn = 0;
+
+  while (drawn < Count) {
+    if (getrandom(words, sizeof(words), 0) != (ssize_t)sizeof(words)) {
+      return false;
+    }
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]) && drawn < Count; i++) {
+      if (words[i] < limit) {
+        Indexes[drawn++] = words[i] % Bound;
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief
+ * A method to draw a random key schedule for a new license, i.e., a random pair of distinct primes for each byte of the timestamp.
+ *
+ * @param Indexes
+ * The indexes of the drawn primes in the pool, (p, q) for each pair. They are kept in the checksum file of the license, to look up the key schedule when the license is inspected.
+ * @param KeySchedule
+ * The drawn key schedule (see LicenseTimeStampOperation)
+ * @return OperationState
+ * The operational state of drawing the key schedule
+ */
+OperationState LicensePrimePool::DrawKeySchedule(vector<uint32_t> &Indexes, prime_list &KeySchedule) const {
+  Indexes.clear();
+  KeySchedule.clear();
+
+  if (PrimeCount < 2) {
+    return INVALID_PARAMETER;
+  }
+
+  // the key material must not be predictable from the key schedules of other licenses, so the indexes are drawn from the kernel, not from a seeded generator.
+  uint64_t bound = min<uint64_t>(PrimeCount, (uint64_t)UINT32_MAX + 1);
+  uint32_t drawn[2 * KEY_SCHEDULE_LENGTH];
+  if (!DrawRandomIndexes(bound, drawn, 2 * KEY_SCHEDULE_LENGTH)) {
+    cout << "Unable to draw random numbers from the kernel." << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  for (int i = 0; i < KEY_SCHEDULE_LENGTH; i++) {
+    uint32_t p = drawn[2 * i];
+    uint32_t q = drawn[2 * i + 1];
+    while (q == p) {
+      if (!DrawRandomIndexes(bound, &q, 1)) {
+        Indexes.clear();
+        KeySchedule.clear();
+        cout << "Unable to draw random numbers from the kernel." << endl;
+        return FILE_FAIL_OPEN;
+      }
+    }
+    Indexes.push_back(p);
+    Indexes.push_back(q);
+    KeySchedule.push_back(tuple<uint64_t, uint64_t>(Primes[p], Primes[q]));
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A method to look up the key schedule of an issued license from the indexes of its primes.
+ *
+ * @param Indexes
+ * The indexes of the primes in the pool, (p, q) for each pair (see DrawKeySchedule)
+ * @param KeySchedule
+ * The key schedule of the license
+ * @return OperationState
+ * The operational state of looking up the key schedule
+ */
+OperationState LicensePrimePool::LookupKeySchedule(const vector<uint32_t> &Indexes, prime_list &KeySchedule) const {
+  KeySchedule.clear();
+
+  if (Indexes.empty() || Indexes.size() % 2 != 0) {
+    return INVALID_PARAMETER;
+  }
+
+  for (size_t i = 0; i < Indexes.size(); i += 2) {
+    if (Indexes[i] >= PrimeCount || Indexes[i + 1] >= PrimeCount) {
+      KeySchedule.clear();
+      return INVALID_PARAMETER;
+    }
+    KeySchedule.push_back(tuple<uint64_t, uint64_t>(Primes[Indexes[i]], Primes[Indexes[i + 1]]));
+  }
+
+  return SUCCESS;
+}
+
+size_t LicensePrimePool::GetPrimeCount() const {
+  return PrimeCount;
+}
+
+int LicensePrimePool::GetPrimeBits() const {
+  return PrimeBits;
+}
@@ -0,0 +1,484 @@
+/**
+ * @file LicenseRegistry.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The compact in-memory registry of verified licenses.
+ *
+ * Each license is a 16-byte record (the identity, and a 40-bit deadline with 24 status bits) in an open-addressing hash table with linear probing.
+ * The table is filled up to 80%, so a license costs about 20 bytes, instead of the hundreds of bytes of a LicenseTimeStampOperation.
+ * The slot of a license is its mixed identity scaled to the table size (i.e., a multiply instead of a modulo), so the table does not need a power-of-two size:
+ * the arena is rounded up to whole huge pages and the unused space of the last one is used for more slots. The table doubles when it is filled up to the load factor.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseRegistry.h"
+#include "../include/LicenseRevocationList.h"
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The size of a huge page (2 MiB on x86-64 and ARM64), which is the allocation unit of the arena.
+ */
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * @brief
+ * The maximal load factor of the hash table (in percent). The table grows before it is filled any further.
+ */
+const size_t REGISTRY_MAX_LOAD_PERCENT = 80;
+
+/**
+ * @brief
+ * The number of lookups ahead whose slots are prefetched by the batched expiry check.
+ */
+const size_t REGISTRY_PREFETCH_DISTANCE = 16;
+
+const uint64_t REGISTRY_DEADLINE_MASK = (1ULL << REGISTRY_DEADLINE_BITS) - 1;
+const uint64_t REGISTRY_STATUS_MASK = (1ULL << (64 - REGISTRY_DEADLINE_BITS)) - 1;
+
+/**
+ * @brief
+ * A function to mix the bits of a license identity (the finalizer of splitmix64), so that the identities with similar bits spread over the whole table.
+ */
+static inline uint64_t MixBits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * @brief
+ * A function to allocate a zeroed arena, from huge pages if any is reserved, or else from normal pages advised to be backed by transparent huge pages.
+ *
+ * @param Length
+ * The length of the arena (a multiple of HUGE_PAGE_SIZE)
+ * @param HugePages
+ * Whether the arena is backed by the reserved huge pages
+ * @return void*
+ * The arena, or nullptr if it fails to be allocated
+ */
+static void *AllocateArena(size_t Length, bool &HugePages) {
+  void *arena = mmap(nullptr, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  HugePages = arena != MAP_FAILED;
+  if (HugePages) {
+    return arena;
+  }
+
+  arena = mmap(nullptr, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (arena == MAP_FAILED) {
+    return nullptr;
+  }
+  madvise(arena, Length, MADV_HUGEPAGE);
+
+  return arena;
+}
+
+/**
+ * @brief Construct a new License Registry:: License Registry object
+ *
+ * @param ExpectedLicenses
+ * The number of licenses to reserve the memory for, so that the table does not grow while they are inserted
+ */
+LicenseRegistry::LicenseRegistry(size_t ExpectedLicenses)
+  : Slots(nullptr), Capacity(0), Count(0), ArenaLength(0), HugePages(false), HasZeroId(false) {
+  ZeroRecord.Id = 0;
+  ZeroRecord.DeadlineAndStatus = 0;
+  if (ExpectedLicenses > 0) {
+    Reserve(ExpectedLicenses);
+  }
+}
+
+LicenseRegistry::~LicenseRegistry() {
+  if (Slots != nullptr) {
+    munmap(Slots, ArenaLength);
+  }
+}
+
+/**
+ * @brief
+ * An API to reserve the memory for the given number of licenses.
+ *
+ * @param ExpectedLicenses
+ * The number of licenses
+ * @return OperationState
+ * The operational state of the reservation
+ */
+OperationState LicenseRegistry::Reserve(size_t ExpectedLicenses) {
+  size_t required = ExpectedLicenses * 100 / REGISTRY_MAX_LOAD_PERCENT + 1;
+
+  return required > Capacity ? Rehash(required) : SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to move the records into a new arena with at least the given number of slots. The unused space of the last huge page is used for more slots.
+ */
+OperationState LicenseRegistry::Rehash(size_t NewCapacity) {
+  size_t length = (NewCapacity * sizeof(RegistryRecord) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  bool hugePages = false;
+  RegistryRecord *slots = (RegistryRecord *)AllocateArena(length, hugePages);
+
+  if (slots == nullptr) {
+    cout << "Unable to allocate " << length << " bytes for the license registry." << endl;
+    return INVALID_PARAMETER;
+  }
+
+  RegistryRecord *oldSlots = Slots;
+  size_t oldCapacity = Capacity;
+  size_t oldLength = ArenaLength;
+
+  Slots = slots;
+  Capacity = length / sizeof(RegistryRecord);
+  ArenaLength = length;
+  HugePages = hugePages;
+
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (oldSlots[i].Id == 0) {
+      continue;
+    }
+    size_t slot = GetHomeSlot(oldSlots[i].Id);
+    while (Slots[slot].Id != 0) {
+      slot = slot + 1 == Capacity ? 0 : slot + 1;
+    }
+    Slots[slot] = oldSlots[i];
+  }
+
+  if (oldSlots != nullptr) {
+    munmap(oldSlots, oldLength);
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to retrieve the first slot to probe for a license, i.e., the mixed identity scaled to the table size.
+ */
+inline size_t LicenseRegistry::GetHomeSlot(license_id Id) const {
+  return (size_t)(((unsigned __int128)MixBits(Id) * Capacity) >> 64);
+}
+
+/**
+ * @brief
+ * A function to find the record of a license, or nullptr if it is not in the registry. The identity 0 marks an empty slot, so its record is kept aside.
+ */
+inline const RegistryRecord *LicenseRegistry::Find(license_id Id) const {
+  if (Id == 0) {
+    return HasZeroId ? &ZeroRecord : nullptr;
+  }
+  if (Capacity == 0) {
+    return nullptr;
+  }
+
+  size_t slot = GetHomeSlot(Id);
+  while (true) {
+    const RegistryRecord *record = &Slots[slot];
+    if (record->Id == Id) {
+      return record;
+    }
+    if (record->Id == 0) {
+      return nullptr;
+    }
+    slot = slot + 1 == Capacity ? 0 : slot + 1;
+  }
+}
+
+/**
+ * @brief
+ * An API to add a license to the registry, or to update its deadline and status.
+ *
+ * @param Id
+ * The license identity (see LicenseTimeStampOperation::GetLicenseId)
+ * @param Deadline
+ * The license expiry deadline (see LicenseTimeStampOperation::GetExpiryDeadline). It shall fit into REGISTRY_DEADLINE_BITS bits.
+ * @param Status
+ * The status bits of the license (see LicenseRegistryStatus). They shall fit into the remaining 24 bits.
+ * @return OperationState
+ * The operational state of the insertion
+ */
+OperationState LicenseRegistry::Insert(license_id Id, time_t Deadline, uint32_t Status) {
+  OperationState ret = SUCCESS;
+
+  if (Deadline < 0 || (uint64_t)Deadline > REGISTRY_DEADLINE_MASK || Status > REGISTRY_STATUS_MASK) {
+    return INVALID_PARAMETER;
+  }
+
+  uint64_t packed = ((uint64_t)Status << REGISTRY_DEADLINE_BITS) | (uint64_t)Deadline;
+
+  if (Id == 0) {
+    Count += HasZeroId ? 0 : 1;
+    HasZeroId = true;
+    ZeroRecord.DeadlineAndStatus = packed;
+    return SUCCESS;
+  }
+
+  if ((Count + 1) * 100 > Capacity * REGISTRY_MAX_LOAD_PERCENT && (ret = Rehash(Capacity < 1024 ? 1024 : Capacity * 2)) != SUCCESS) {
+    return ret;
+  }
+
+  size_t slot = GetHomeSlot(Id);
+  while (Slots[slot].Id != 0 && Slots[slot].Id != Id) {
+    slot = slot + 1 == Capacity ? 0 : slot + 1;
+  }
+  if (Slots[slot].Id == 0) {
+    Slots[slot].Id = Id;
+    Count++;
+  }
+  Slots[slot].DeadlineAndStatus = packed;
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * An API to verify a license (i.e., decrypt and tamper-check its timestamp) and add it to the registry with its deadline.
+ * A license which fails to be verified is added as well (if its identity can be retrieved), with the REGISTRY_STATUS_TAMPERED bit, so that it is reported as expired.
+ *
+ * @param Operation
+ * The license timestamp operation of the license
+ * @param RevocationList
+ * The revocation list to check the license against, or nullptr
+ * @return OperationState
+ * The operational state of the verification
+ */
+OperationState LicenseRegistry::RegisterLicense(LicenseTimeStampOperation &Operation, const LicenseRevocationList *RevocationList) {
+  OperationState ret = SUCCESS;
+  license_id id = 0;
+  time_t startTime, deadline;
+  uint32_t status = REGISTRY_STATUS_VERIFIED;
+
+  if ((ret = Operation.GetLicenseId(id)) != SUCCESS) {
+    // a license found tampered with is flagged under the serial its checksum file claims, if any.
+    if (ret == TIMESTAMP_TAMPERED && id != 0) {
+      RecordVerification(id, 0, REGISTRY_STATUS_TAMPERED, false);
+    }
+    return ret;
+  }
+
+  if ((ret = Operation.GetExpiryDeadline(startTime, deadline)) != SUCCESS) {
+    RecordVerification(id, 0, REGISTRY_STATUS_TAMPERED, false);
+    return ret;
+  }
+  if (RevocationList != nullptr && RevocationList->IsRevoked(id)) {
+    status |= REGISTRY_STATUS_REVOKED;
+  }
+
+  return RecordVerification(id, deadline, status, RevocationList != nullptr);
+}
+
+/**
+ * @brief
+ * An API to add the result of a license verification to the registry. The status of the license is the one of the latest verification
+ * (e.g., a license restored after it was found tampered with is valid again once it is verified), except for the REGISTRY_STATUS_REVOKED bit,
+ * which is only changed by a verification against a revocation list. A failed verification keeps the deadline of the license verified before.
+ *
+ * @param Id
+ * The license identity (see LicenseTimeStampOperation::GetLicenseId)
+ * @param Deadline
+ * The license expiry deadline, or 0 if the verification failed
+ * @param Status
+ * The status bits of the verification (see LicenseRegistryStatus)
+ * @param RevocationChecked
+ * Whether the license was checked against a revocation list, i.e., whether the REGISTRY_STATUS_REVOKED bit of Status is the outcome of the verification
+ * @return OperationState
+ * The operational state of the insertion
+ */
+OperationState LicenseRegistry::RecordVerification(license_id Id, time_t Deadline, uint32_t Status, bool RevocationChecked) {
+  time_t knownDeadline = 0;
+  uint32_t knownStatus = 0;
+
+  if (!Lookup(Id, knownDeadline, knownStatus)) {
+    return Insert(Id, Deadline, Status);
+  }
+  if (!RevocationChecked) {
+    Status = (Status & ~(uint32_t)REGISTRY_STATUS_REVOKED) | (knownStatus & REGISTRY_STATUS_REVOKED);
+  }
+  if ((Status & REGISTRY_STATUS_TAMPERED) != 0) {
+    return Insert(Id, knownDeadline, Status);
+  }
+
+  return Insert(Id, Deadline, Status);
+}
+
+/**
+ * @brief
+ * An API to remove a license from the registry. The records after it in the same probe sequence are shifted back, so no tombstone is left behind.
+ *
+ * @param Id
+ * The license identity
+ * @return bool
+ * false if the license is not in the registry
+ */
+bool LicenseRegistry::Remove(license_id Id) {
+  const RegistryRecord *record = Find(Id);
+
+  if (record == nullptr) {
+    return false;
+  }
+  Count--;
+  if (Id == 0) {
+    HasZeroId = false;
+    return true;
+  }
+
+  size_t hole = record - Slots;
+  size_t slot = hole;
+  while (true) {
+    slot = slot + 1 == Capacity ? 0 : slot + 1;
+    if (Slots[slot].Id == 0) {
+      break;
+    }
+    // a record can fill the hole only if its home slot is not cyclically within (hole, slot].
+    size_t home = GetHomeSlot(Slots[slot].Id);
+    bool between = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+    if (!between) {
+      Slots[hole] = Slots[slot];
+      hole = slot;
+    }
+  }
+  Slots[hole].Id = 0;
+  Slots[hole].DeadlineAndStatus = 0;
+
+  return true;
+}
+
+/**
+ * @brief
+ * An API to look up the deadline and the status bits of a license.
+ *
+ * @param Id
+ * The license identity
+ * @param Deadline
+ * The license expiry deadline
+ * @param Status
+ * The status bits of the license (see LicenseRegistryStatus)
+ * @return bool
+ * false if the license is not in the registry
+ */
+bool LicenseRegistry::Lookup(license_id Id, time_t &Deadline, uint32_t &Status) const {
+  const RegistryRecord *record = Find(Id);
+
+  if (record == nullptr) {
+    return false;
+  }
+  Deadline = (time_t)(record->DeadlineAndStatus & REGISTRY_DEADLINE_MASK);
+  Status = (uint32_t)(record->DeadlineAndStatus >> REGISTRY_DEADLINE_BITS);
+
+  return true;
+}
+
+/**
+ * @brief
+ * A function to check if the license of a record has expired, i.e., it is not verified, it is revoked, or its deadline has passed.
+ */
+inline bool LicenseRegistry::IsRecordExpired(const RegistryRecord *Record, time_t Now) const {
+  if (Record == nullptr) {
+    return true;
+  }
+
+  uint64_t status = Record->DeadlineAndStatus >> REGISTRY_DEADLINE_BITS;
+  uint64_t deadline = Record->DeadlineAndStatus & REGISTRY_DEADLINE_MASK;
+
+  return (status & (REGISTRY_STATUS_VERIFIED | REGISTRY_STATUS_REVOKED | REGISTRY_STATUS_TAMPERED)) != REGISTRY_STATUS_VERIFIED || Now < 0 || (uint64_t)Now > deadline;
+}
+
+/**
+ * @brief
+ * An API to check if a license has expired. A license which is not in the registry is treated as expired.
+ *
+ * @param Id
+ * The license identity
+ * @param Now
+ * The current time
+ * @return bool
+ * true if the license has expired, has been revoked, failed its verification or is not in the registry
+ */
+bool LicenseRegistry::IsExpired(license_id Id, time_t Now) const {
+  return IsRecordExpired(Find(Id), Now);
+}
+
+/**
+ * @brief
+ * An API to check the expiry of a batch of licenses. The slots of the licenses a few lookups ahead are prefetched, so the cache misses of the lookups overlap.
+ *
+ * @param Ids
+ * The license identities
+ * @param Count
+ * The number of licenses
+ * @param Now
+ * The current time
+ * @param Expired
+ * The expiry of each license (see IsExpired)
+ */
+void LicenseRegistry::IsExpired(const license_id *Ids, size_t Count, time_t Now, bool *Expired) const {
+  if (Capacity == 0) {
+    for (size_t i = 0; i < Count; i++) {
+      Expired[i] = IsRecordExpired(Find(Ids[i]), Now);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < Count && i < REGISTRY_PREFETCH_DISTANCE; i++) {
+    __builtin_prefetch(&Slots[GetHomeSlot(Ids[i])]);
+  }
+  for (size_t i = 0; i < Count; i++) {
+    if (i + REGISTRY_PREFETCH_DISTANCE < Count) {
+      __builtin_prefetch(&Slots[GetHomeSlot(Ids[i + REGISTRY_PREFETCH_DISTANCE])]);
+    }
+    Expired[i] = IsRecordExpired(Find(Ids[i]), Now);
+  }
+}
+
+/**
+ * @brief
+ * A method to retrieve the number of licenses in the registry.
+ */
+size_t LicenseRegistry::GetCount() const {
+  return Count;
+}
+
+/**
+ * @brief
+ * A method to retrieve the number of slots of the hash table.
+ */
+size_t LicenseRegistry::GetCapacity() const {
+  return Capacity;
+}
+
+/**
+ * @brief
+ * A method to retrieve the memory allocated for the registry (in bytes), i.e., the arena and the registry itself.
+ */
+size_t LicenseRegistry::GetMemoryBytes() const {
+  return ArenaLength + sizeof(*this);
+}
+
+/**
+ * @brief
+ * A method to retrieve the memory allocated per license (in bytes).
+ */
+double LicenseRegistry::GetBytesPerLicense() const {
+  return Count == 0 ? 0 : (double)GetMemoryBytes() / Count;
+}
+
+/**
+ * @brief
+ * A method to check if the arena is backed by the reserved huge pages (MAP_HUGETLB). Otherwise it is advised to be backed by transparent huge pages (MADV_HUGEPAGE).
+ */
+bool LicenseRegistry::IsHugePageBacked() const {
+  return HugePages;
+}
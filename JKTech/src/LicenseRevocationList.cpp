@@ -0,0 +1,255 @@
+/**
+ * @file LicenseRevocationList.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The revocation list of the licenses, so that a license can be revoked before its duration runs out.
+ *
+ * The revocation file is a header followed by the sorted identities of the revoked licenses. It is memory-mapped when loaded,
+ * and a blocked Bloom filter (one cache line per license) is built in front of it so that checking a license which is not revoked stays cheap regardless of the size of the list.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseRevocationList.h"
+#include <iostream>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/**
+ * @brief
+ * The header of the revocation file.
+ */
+struct RevocationFileHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint64_t Count;
+};
+
+const char REVOCATION_MAGIC[4] = {'L', 'R', 'V', 'K'};
+const uint32_t REVOCATION_VERSION = 1;
+
+/**
+ * @brief
+ * A function to mix the bits of a license identity (the finalizer of splitmix64), so that the identities with similar bits spread over the whole filter.
+ */
+static inline uint64_t MixBits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+LicenseRevocationList::LicenseRevocationList()
+  : Mapping(nullptr), MappingLength(0), RevokedIds(nullptr), RevokedCount(0), Filter(nullptr), FilterBlocks(0) {
+}
+
+LicenseRevocationList::~LicenseRevocationList() {
+  Unload();
+}
+
+/**
+ * @brief
+ * A function to release the memory mapping and the Bloom filter of the current revocation file.
+ */
+void LicenseRevocationList::Unload() {
+  if (Mapping != nullptr) {
+    munmap(Mapping, MappingLength);
+  }
+  free(Filter);
+
+  Mapping = nullptr;
+  MappingLength = 0;
+  RevokedIds = nullptr;
+  RevokedCount = 0;
+  Filter = nullptr;
+  FilterBlocks = 0;
+}
+
+/**
+ * @brief
+ * A method to write the revocation file. The identities are sorted and deduplicated, and the file is replaced atomically (see WriteFileAtomically),
+ * so that a service loading the revocation file never sees a partially written list, even after a crash.
+ *
+ * @param RevocationFileName
+ * The location and file name of the revocation file
+ * @param RevokedIds
+ * The identities of the revoked licenses (see LicenseTimeStampOperation::GetLicenseId)
+ * @return OperationState
+ * The operational state of writing the revocation file
+ */
+OperationState LicenseRevocationList::WriteRevocationFile(const string &RevocationFileName, vector<license_id> RevokedIds) {
+  if (RevocationFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  sort(RevokedIds.begin(), RevokedIds.end());
+  RevokedIds.erase(unique(RevokedIds.begin(), RevokedIds.end()), RevokedIds.end());
+
+  RevocationFileHeader header;
+  memcpy(header.Magic, REVOCATION_MAGIC, sizeof(header.Magic));
+  header.Version = REVOCATION_VERSION;
+  header.Count = RevokedIds.size();
+
+  string content((const char *)&header, sizeof(header));
+  if (!RevokedIds.empty()) {
+    content.append((const char *)RevokedIds.data(), RevokedIds.size() * sizeof(license_id));
+  }
+
+  return WriteFileAtomically(RevocationFileName, content);
+}
+
+/**
+ * @brief
+ * A method to load (i.e., memory-map) the revocation file and build the Bloom filter in front of it. The previously loaded revocation file, if any, is released.
+ *
+ * @param RevocationFileName
+ * The location and file name of the revocation file
+ * @return OperationState
+ * The operational state of loading the revocation file
+ */
+OperationState LicenseRevocationList::LoadRevocationFile(const string &RevocationFileName) {
+  Unload();
+
+  if (RevocationFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  int fd = open(RevocationFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  struct stat buffer;
+  if (fstat(fd, &buffer) != 0 || (size_t)buffer.st_size < sizeof(RevocationFileHeader)) {
+    close(fd);
+    cout << "Malformed revocation file, " << RevocationFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  MappingLength = buffer.st_size;
+  Mapping = mmap(nullptr, MappingLength, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (Mapping == MAP_FAILED) {
+    Mapping = nullptr;
+    MappingLength = 0;
+    return FILE_FAIL_OPEN;
+  }
+
+  const RevocationFileHeader *header = (const RevocationFileHeader *)Mapping;
+  if (memcmp(header->Magic, REVOCATION_MAGIC, sizeof(header->Magic)) != 0 || header->Version != REVOCATION_VERSION ||
+      (MappingLength - sizeof(RevocationFileHeader)) % sizeof(license_id) != 0 ||
+      header->Count != (MappingLength - sizeof(RevocationFileHeader)) / sizeof(license_id)) {
+    Unload();
+    cout << "Malformed revocation file, " << RevocationFileName << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+
+  RevokedIds = (const license_id *)((const char *)Mapping + sizeof(RevocationFileHeader));
+  RevokedCount = header->Count;
+
+  // the binary search over the sorted identities only touches the pages it needs
+  madvise(Mapping, MappingLength, MADV_RANDOM);
+
+  FilterBlocks = (RevokedCount * BLOOM_BITS_PER_LICENSE + 511) / 512;
+  if (FilterBlocks == 0) {
+    FilterBlocks = 1;
+  }
+  if (posix_memalign((void **)&Filter, sizeof(BloomBlock), FilterBlocks * sizeof(BloomBlock)) != 0) {
+    Filter = nullptr;
+    Unload();
+    return FILE_FAIL_OPEN;
+  }
+  memset(Filter, 0, FilterBlocks * sizeof(BloomBlock));
+
+  for (size_t i = 0; i < RevokedCount; i++) {
+    // the binary search silently misses the revoked licenses of an unsorted list, so such a list is rejected as a whole.
+    if (i > 0 && !(RevokedIds[i - 1] < RevokedIds[i])) {
+      Unload();
+      cout << "Unsorted revocation file, " << RevocationFileName << endl;
+      return TIMESTAMP_TAMPERED;
+    }
+
+    uint64_t hash = MixBits(RevokedIds[i]);
+    BloomBlock &block = Filter[(hash >> 32) % FilterBlocks];
+
+    // 7 bit positions of 9 bits each are taken from a second hash, all of them within the same block.
+    uint64_t bits = MixBits(hash);
+    for (int k = 0; k < BLOOM_HASH_COUNT; k++) {
+      uint32_t bit = (bits >> (9 * k)) & 511;
+      block.Words[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    }
+  }
+
+  if (DEBUG) {
+    cout << "Loaded " << RevokedCount << " revoked license(s) with a Bloom filter of " << FilterBlocks << " block(s)." << endl;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ * A function to check a license identity against the Bloom filter.
+ *
+ * @return true
+ * The license may have been revoked, and shall be looked up in the revocation file
+ * @return false
+ * The license has definitely not been revoked
+ */
+bool LicenseRevocationList::MayBeRevoked(license_id Id) const {
+  uint64_t hash = MixBits(Id);
+  const BloomBlock &block = Filter[(hash >> 32) % FilterBlocks];
+  uint64_t bits = MixBits(hash);
+
+  for (int k = 0; k < BLOOM_HASH_COUNT; k++) {
+    uint32_t bit = (bits >> (9 * k)) & 511;
+    if ((block.Words[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief
+ * An API to check if a license has been revoked.
+ *
+ * @param Id
+ * The license identity (see LicenseTimeStampOperation::GetLicenseId)
+ * @return true
+ * The license has been revoked
+ * @return false
+ * The license has not been revoked, or no revocation file has been loaded
+ */
+bool LicenseRevocationList::IsRevoked(license_id Id) const {
+  if (RevokedCount == 0 || !MayBeRevoked(Id)) {
+    return false;
+  }
+  return binary_search(RevokedIds, RevokedIds + RevokedCount, Id);
+}
+
+size_t LicenseRevocationList::GetRevokedCount() const {
+  return RevokedCount;
+}
+
+/**
+ * @brief
+ * A method to retrieve the size of the Bloom filter (in bytes)
+ */
+size_t LicenseRevocationList::GetFilterSize() const {
+  return FilterBlocks * sizeof(BloomBlock);
+}
@@ -0,0 +1,480 @@
+/**
+ * @file LicenseStateSnapshot.cpp
+ * @author Hailun Tan (Haiun.Tan@gmail.com)
+ * @brief
+ *
+ * The persistent snapshot of the verified licenses, to make the cold start of a service skip the verification of the licenses which have not changed.
+ *
+ * The snapshot file is a header, the fixed-size records of the licenses and a string table with their file names. It is written into a temporary file and renamed,
+ * and its SHA-256 digest is kept in a separate digest file, so a snapshot which was tampered with (e.g., to extend a deadline) is rejected as a whole.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/LicenseStateSnapshot.h"
+#include "../include/LicenseDigest.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief
+ * The header of the snapshot file.
+ */
+struct SnapshotFileHeader {
+  char Magic[4];
+  uint32_t Version;
+  uint64_t Count;
+  uint64_t FileNamesLength;
+};
+
+const char SNAPSHOT_MAGIC[4] = {'L', 'S', 'N', 'P'};
+const uint32_t SNAPSHOT_VERSION = 1;
+
+/**
+ * @brief
+ * How a license of the snapshot was restored.
+ *
+ * @SNAPSHOT_UNCHANGED: its files have the same identities as in the snapshot
+ * @SNAPSHOT_REHASHED: its files have new identities, but the same content as in the snapshot
+ * @SNAPSHOT_REVERIFIED: its files have changed, and the license was verified again
+ * @SNAPSHOT_MISSING: its files do not exist any more, and the license was dropped
+ */
+enum SnapshotOutcome {
+  SNAPSHOT_UNCHANGED,
+  SNAPSHOT_REHASHED,
+  SNAPSHOT_REVERIFIED,
+  SNAPSHOT_MISSING
+};
+
+/**
+ * @brief
+ * A function to retrieve the identity of a file.
+ */
+static bool GetFileIdentity(const string &name, SnapshotFileIdentity &identity) {
+  struct stat buffer;
+
+  memset(&identity, 0, sizeof(identity));
+  if (stat(name.c_str(), &buffer) != 0) {
+    return false;
+  }
+  identity.Device = buffer.st_dev;
+  identity.Inode = buffer.st_ino;
+  identity.Size = buffer.st_size;
+  identity.ModificationTime = (int64_t)buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+  identity.ChangeTime = (int64_t)buffer.st_ctim.tv_sec * 1000000000 + buffer.st_ctim.tv_nsec;
+
+  return true;
+}
+
+/**
+ * @brief
+ * A function to compute the content hash of a license, i.e., the first 8 bytes of the SHA-256 digest of both files.
+ */
+static bool ComputeContentHash(const string &encryptionFileName, const string &checkSumFileName, uint64_t &hash) {
+  ifstream encryptionFile(encryptionFileName, ios::binary);
+  ifstream checkSumFile(checkSumFileName, ios::binary);
+
+  if (!encryptionFile.is_open() || !checkSumFile.is_open()) {
+    return false;
+  }
+
+  ostringstream content;
+  content << encryptionFile.rdbuf();
+  content << '\0';
+  content << checkSumFile.rdbuf();
+
+  string bytes = content.str();
+  license_digest digest = ComputeDigest(bytes.data(), bytes.length());
+  hash = 0;
+  for (int i = 0; i < 8; i++) {
+    hash = (hash << 8) | digest[i];
+  }
+
+  return true;
+}
+
+/**
+ * @brief Construct a new License State Snapshot:: License State Snapshot object
+ *
+ * @param LicenseDuration
+ * The license duration (in days)
+ * @param ThreadCount
+ * The number of threads to restore the licenses of a snapshot
+ * @param KeySchedule
+ * The key schedule of the licenses (see LicenseTimeStampOperation). An empty key schedule is the default one.
+ * @param PrimePool
+ * The prime pool to look up the key schedule of the licenses issued from it, or nullptr. It shall outlive the snapshot.
+ */
+LicenseStateSnapshot::LicenseStateSnapshot(double LicenseDuration, int ThreadCount, const prime_list &KeySchedule, const LicensePrimePool *PrimePool)
+  : LicenseDurationInDays(LicenseDuration), ThreadCount(ThreadCount < 1 ? 1 : ThreadCount), KeySchedule(KeySchedule), PrimePool(PrimePool) {
+  memset(&Statistics, 0, sizeof(Statistics));
+}
+
+/**
+ * @brief
+ * A function to verify a license (i.e., decrypt and tamper-check its timestamp) into a record. The file identities are taken before the files are read,
+ * so a file changed in between does not match the record when the snapshot is loaded.
+ *
+ * @return OperationState
+ * The operational state of the verification. The record is kept unless the files do not exist (FILE_NOT_EXIST).
+ */
+OperationState LicenseStateSnapshot::VerifyRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName) const {
+  OperationState ret = SUCCESS;
+  time_t startTime, deadline;
+
+  if (!GetFileIdentity(EncryptionFileName, Record.Files[0]) || !GetFileIdentity(CheckSumFileName, Record.Files[1]) ||
+      !ComputeContentHash(EncryptionFileName, CheckSumFileName, Record.ContentHash)) {
+    return FILE_NOT_EXIST;
+  }
+
+  LicenseTimeStampOperation operation(EncryptionFileName, CheckSumFileName, LicenseDurationInDays, KeySchedule, PrimePool);
+  if ((ret = operation.GetLicenseId(Record.Id)) != SUCCESS || (ret = operation.GetExpiryDeadline(startTime, deadline)) != SUCCESS) {
+    Record.StartTime = 0;
+    Record.Status = REGISTRY_STATUS_TAMPERED;
+  } else {
+    Record.StartTime = startTime;
+    Record.Status = REGISTRY_STATUS_VERIFIED;
+  }
+
+  return ret;
+}
+
+/**
+ * @brief
+ * A function to restore a license of the snapshot: it is kept as it is if its files are unchanged, or if they have the same content, and verified again otherwise.
+ *
+ * @return int
+ * How the license was restored (see SnapshotOutcome)
+ */
+int LicenseStateSnapshot::RestoreRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName) const {
+  SnapshotFileIdentity identities[2];
+  uint64_t hash = 0;
+
+  if (!GetFileIdentity(EncryptionFileName, identities[0]) || !GetFileIdentity(CheckSumFileName, identities[1])) {
+    return SNAPSHOT_MISSING;
+  }
+  if (memcmp(identities, Record.Files, sizeof(identities)) == 0) {
+    return SNAPSHOT_UNCHANGED;
+  }
+
+  if (ComputeContentHash(EncryptionFileName, CheckSumFileName, hash) && hash == Record.ContentHash) {
+    memcpy(Record.Files, identities, sizeof(identities));
+    return SNAPSHOT_REHASHED;
+  }
+
+  return VerifyRecord(Record, EncryptionFileName, CheckSumFileName) == FILE_NOT_EXIST ? SNAPSHOT_MISSING : SNAPSHOT_REVERIFIED;
+}
+
+/**
+ * @brief
+ * A function to read the given number of bytes of a file from the given offset.
+ */
+static bool ReadAt(int fd, void *buffer, size_t length, off_t offset) {
+  char *p = (char *)buffer;
+
+  while (length > 0) {
+    ssize_t n = pread(fd, p, length, offset);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    offset += n;
+    length -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief
+ * A function to add the license of a record to the registry, with its deadline computed from the current license duration.
+ */
+OperationState LicenseStateSnapshot::InsertRecord(const SnapshotRecord &Record, LicenseRegistry &Registry) const {
+  time_t deadline = (Record.Status & REGISTRY_STATUS_VERIFIED) != 0 ? (time_t)Record.StartTime + (time_t)(LicenseDurationInDays * 60 * 60 * 24) : 0;
+
+  // the snapshot does not keep the revocation of a license, so the registry keeps the one it knows.
+  return Registry.RecordVerification(Record.Id, deadline < 0 ? 0 : deadline, Record.Status, false);
+}
+
+/**
+ * @brief
+ * An API to verify a license which is not in the snapshot yet, add it to the registry, and keep it for the next snapshot file.
+ *
+ * @param EncryptionFileName
+ * The location and file name of the encrypted timestamp file
+ * @param CheckSumFileName
+ * The location and file name of the timestamp checksum file
+ * @param Registry
+ * The registry to add the license to
+ * @return OperationState
+ * The operational state of the verification. A license which fails to be verified is added as well, with the REGISTRY_STATUS_TAMPERED bit.
+ */
+OperationState LicenseStateSnapshot::AddLicense(const string &EncryptionFileName, const string &CheckSumFileName, LicenseRegistry &Registry) {
+  OperationState ret = SUCCESS;
+  SnapshotRecord record;
+
+  memset(&record, 0, sizeof(record));
+  if (EncryptionFileName.empty() || CheckSumFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+  if ((ret = VerifyRecord(record, EncryptionFileName, CheckSumFileName)) == FILE_NOT_EXIST) {
+    return ret;
+  }
+
+  OperationState inserted = KeepRecord(record, EncryptionFileName, CheckSumFileName, Registry);
+
+  return ret != SUCCESS ? ret : inserted;
+}
+
+/**
+ * @brief
+ * An API to verify the licenses which are not in the snapshot yet in parallel (see AddLicense), add them to the registry, and keep them for the next snapshot file.
+ * The licenses are added to the registry in their order, from the calling thread.
+ *
+ * @param Files
+ * The encrypted timestamp file and the checksum file of each license
+ * @param Registry
+ * The registry to add the licenses to
+ * @return OperationState
+ * The operational state of the first license which failed to be verified (or added), or SUCCESS. The other licenses are added all the same.
+ */
+OperationState LicenseStateSnapshot::AddLicenses(const license_file_list &Files, LicenseRegistry &Registry) {
+  OperationState ret = SUCCESS;
+  size_t count = Files.size();
+  vector<SnapshotRecord> records(count);
+  vector<OperationState> results(count);
+  vector<thread> workers;
+  size_t chunk = (count + ThreadCount - 1) / ThreadCount;
+
+  for (int t = 0; t < ThreadCount && (size_t)t * chunk < count; t++) {
+    workers.push_back(thread([this, &Files, &records, &results, chunk, count, t]() {
+      for (size_t i = t * chunk; i < count && i < (t + 1) * chunk; i++) {
+        memset(&records[i], 0, sizeof(SnapshotRecord));
+        results[i] = get<0>(Files[i]).empty() || get<1>(Files[i]).empty() ? INVALID_PARAMETER : VerifyRecord(records[i], get<0>(Files[i]), get<1>(Files[i]));
+      }
+    }));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    OperationState result = results[i];
+    if (result != FILE_NOT_EXIST && result != INVALID_PARAMETER) {
+      OperationState inserted = KeepRecord(records[i], get<0>(Files[i]), get<1>(Files[i]), Registry);
+      result = result != SUCCESS ? result : inserted;
+    }
+    if (ret == SUCCESS) {
+      ret = result;
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * @brief
+ * A function to keep a verified record for the next snapshot file, with its file names, and add its license to the registry.
+ */
+OperationState LicenseStateSnapshot::KeepRecord(SnapshotRecord &Record, const string &EncryptionFileName, const string &CheckSumFileName, LicenseRegistry &Registry) {
+  Record.FileNameOffset = FileNames.length();
+  Record.EncryptionFileNameLength = EncryptionFileName.length();
+  Record.CheckSumFileNameLength = CheckSumFileName.length();
+  FileNames += EncryptionFileName;
+  FileNames += CheckSumFileName;
+  Records.push_back(Record);
+
+  return InsertRecord(Record, Registry);
+}
+
+/**
+ * @brief
+ * An API to load a snapshot file, check it against its digest file, and restore its licenses into the registry in parallel.
+ * Only the licenses whose files changed are verified again, and the licenses whose files do not exist any more are dropped.
+ *
+ * @param SnapshotFileName
+ * The location and file name of the snapshot file
+ * @param DigestFileName
+ * The location and file name of the digest file (see WriteSnapshotFile)
+ * @param Registry
+ * The registry to restore the licenses into
+ * @return OperationState
+ * The operational state of loading the snapshot. INTEGRITY_ROOT_MISMATCH if the snapshot does not match its digest file, in which case no license is restored.
+ */
+OperationState LicenseStateSnapshot::LoadSnapshotFile(const string &SnapshotFileName, const string &DigestFileName, LicenseRegistry &Registry) {
+  OperationState ret = SUCCESS;
+  steady_clock::time_point start = steady_clock::now();
+
+  if (SnapshotFileName.empty() || DigestFileName.empty() || DigestFileName == SnapshotFileName) {
+    return INVALID_PARAMETER;
+  }
+
+  ifstream digestFile(DigestFileName);
+  string hex = "";
+  size_t digestCount = 0;
+  license_digest expected;
+  if (!digestFile.is_open()) {
+    return FILE_NOT_EXIST;
+  }
+  digestFile >> hex >> digestCount;
+  digestFile.close();
+
+  int fd = open(SnapshotFileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return FILE_NOT_EXIST;
+  }
+
+  // the records and the string table are read straight into the vectors the licenses are restored from, after the header is checked against the file size.
+  struct stat buffer;
+  SnapshotFileHeader header;
+  bool readable = fstat(fd, &buffer) == 0 && (size_t)buffer.st_size >= sizeof(SnapshotFileHeader) && ReadAt(fd, &header, sizeof(header), 0);
+  size_t length = readable ? buffer.st_size : 0;
+  size_t count = 0;
+
+  readable = readable && memcmp(header.Magic, SNAPSHOT_MAGIC, sizeof(header.Magic)) == 0 && header.Version == SNAPSHOT_VERSION && header.Count == digestCount &&
+             header.Count <= (length - sizeof(SnapshotFileHeader)) / sizeof(SnapshotRecord) &&
+             sizeof(SnapshotFileHeader) + header.Count * sizeof(SnapshotRecord) + header.FileNamesLength == length;
+  if (readable) {
+    count = header.Count;
+    Records.resize(count);
+    FileNames.resize(header.FileNamesLength);
+    readable = ReadAt(fd, Records.data(), count * sizeof(SnapshotRecord), sizeof(SnapshotFileHeader)) &&
+               ReadAt(fd, &FileNames[0], FileNames.length(), sizeof(SnapshotFileHeader) + count * sizeof(SnapshotRecord));
+  }
+  close(fd);
+
+  // the snapshot is only trusted as a whole, so it is checked against its digest before any license is restored.
+  vector< pair<const void *, size_t> > parts;
+  parts.push_back(make_pair((const void *)&header, sizeof(header)));
+  parts.push_back(make_pair((const void *)Records.data(), count * sizeof(SnapshotRecord)));
+  parts.push_back(make_pair((const void *)FileNames.data(), FileNames.length()));
+  if (!readable || !StringToDigest(hex, expected) || ComputeDigest(parts) != expected) {
+    Records.clear();
+    FileNames.clear();
+    cout << "Snapshot file " << SnapshotFileName << " does not match its digest file." << endl;
+    return INTEGRITY_ROOT_MISMATCH;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (Records[i].FileNameOffset > FileNames.length() ||
+        (uint64_t)Records[i].EncryptionFileNameLength + Records[i].CheckSumFileNameLength > FileNames.length() - Records[i].FileNameOffset) {
+      Records.clear();
+      FileNames.clear();
+      return INTEGRITY_ROOT_MISMATCH;
+    }
+  }
+
+  vector<unsigned char> outcomes(count);
+  vector<thread> workers;
+  size_t chunk = (count + ThreadCount - 1) / ThreadCount;
+
+  for (int t = 0; t < ThreadCount && (size_t)t * chunk < count; t++) {
+    workers.push_back(thread([this, &outcomes, chunk, count, t]() {
+      for (size_t i = t * chunk; i < count && i < (t + 1) * chunk; i++) {
+        SnapshotRecord &record = Records[i];
+        string encryptionFileName = FileNames.substr(record.FileNameOffset, record.EncryptionFileNameLength);
+        string checkSumFileName = FileNames.substr(record.FileNameOffset + record.EncryptionFileNameLength, record.CheckSumFileNameLength);
+        outcomes[i] = RestoreRecord(record, encryptionFileName, checkSumFileName);
+      }
+    }));
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  memset(&Statistics, 0, sizeof(Statistics));
+  Statistics.Licenses = count;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    switch (outcomes[i]) {
+      case SNAPSHOT_UNCHANGED: Statistics.Unchanged++; break;
+      case SNAPSHOT_REHASHED: Statistics.Rehashed++; break;
+      case SNAPSHOT_REVERIFIED: Statistics.Reverified++; break;
+      default: Statistics.Missing++; continue;
+    }
+    if (InsertRecord(Records[i], Registry) != SUCCESS) {
+      ret = INVALID_PARAMETER;
+    }
+    Records[kept++] = Records[i];
+  }
+  Records.resize(kept);
+
+  Statistics.Seconds = duration<double>(steady_clock::now() - start).count();
+
+  return ret;
+}
+
+/**
+ * @brief
+ * An API to write the licenses restored or added so far into a snapshot file, with its digest file.
+ *
+ * @param SnapshotFileName
+ * The location and file name of the snapshot file
+ * @param DigestFileName
+ * The location and file name of the digest file. The digest is not keyed, so the digest file shall be stored where the snapshot file can be written but the digest file cannot
+ * (like the root file of LicenseMerkleTree); otherwise a snapshot which was tampered with could come with a matching digest.
+ * @return OperationState
+ * The operational state of writing the snapshot
+ */
+OperationState LicenseStateSnapshot::WriteSnapshotFile(const string &SnapshotFileName, const string &DigestFileName) const {
+  OperationState ret = SUCCESS;
+
+  if (SnapshotFileName.empty() || DigestFileName.empty() || DigestFileName == SnapshotFileName) {
+    return INVALID_PARAMETER;
+  }
+
+  // the string table is rebuilt, as the file names of the dropped licenses are still in the loaded one.
+  string fileNames;
+  vector<SnapshotRecord> records(Records);
+  for (size_t i = 0; i < records.size(); i++) {
+    size_t offset = fileNames.length();
+    fileNames.append(FileNames, records[i].FileNameOffset, (size_t)records[i].EncryptionFileNameLength + records[i].CheckSumFileNameLength);
+    records[i].FileNameOffset = offset;
+  }
+
+  SnapshotFileHeader header;
+  memcpy(header.Magic, SNAPSHOT_MAGIC, sizeof(header.Magic));
+  header.Version = SNAPSHOT_VERSION;
+  header.Count = records.size();
+  header.FileNamesLength = fileNames.length();
+
+  string content;
+  content.reserve(sizeof(header) + records.size() * sizeof(SnapshotRecord) + fileNames.length());
+  content.append((const char *)&header, sizeof(header));
+  if (!records.empty()) {
+    content.append((const char *)records.data(), records.size() * sizeof(SnapshotRecord));
+  }
+  content.append(fileNames);
+
+  if ((ret = WriteFileAtomically(SnapshotFileName, content)) != SUCCESS) {
+    return ret;
+  }
+
+  ostringstream digest;
+  digest << DigestToString(ComputeDigest(content.data(), content.length())) << " " << records.size() << endl;
+
+  return WriteFileAtomically(DigestFileName, digest.str());
+}
+
+/**
+ * @brief
+ * A method to retrieve the statistics of the last snapshot loaded.
+ */
+LicenseSnapshotStatistics LicenseStateSnapshot::GetStatistics() const {
+  return Statistics;
+}
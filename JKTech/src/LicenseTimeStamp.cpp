@@ -24,15 +24,24 @@
  */
 
 #include "../include/LicenseTimeStamp.h"
+#include "../include/LicenseDigest.h"
+#include "../include/LicenseRevocationList.h"
+#include "../include/LicensePrimePool.h"
 #include <iostream>
 #include<stdlib.h>
 #include<math.h>
 #include<string.h>
+#include <ctype.h>
 #include <fstream>
 #include <unordered_map>
 #include <iomanip>
 #include <limits>
+#include <sstream>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/random.h>
 #include <ctime>
 #include <chrono>
 #include <ctime> 
@@ -61,6 +70,8 @@ const char* LicenseTimeStampOperation::OperationStateToString(OperationState v)
     case FILE_EXIST: return "File exists";
     case TIMESTAMP_RETRIEVAL_ERROR: return "Timestamp fails to be retrieved";
     case TIMESTAMP_TAMPERED: return "Timestamp file has been tampered with";
+    case INTEGRITY_ROOT_MISMATCH: return "License store integrity root does not match";
+    case LICENSE_REVOKED: return "License has been revoked";
     default:      return "Unknown State";
   }
 }
@@ -79,43 +90,74 @@ LicenseTimeStampOperation::LicenseTimeStampOperation(string encryptionFileName,
   EncryptionFileName = encryptionFileName;
   CheckSumFileName = checksumFileName;
   LicenseDurationInDays = LicenseDuration;
-  PrimeList.push_back(tuple<double, double>(11.0,13.0));
-  PrimeList.push_back(tuple<double, double>(11.0,17.0));
-  PrimeList.push_back(tuple<double, double>(11.0,19.0));
-  PrimeList.push_back(tuple<double, double>(11.0,23.0));
-  PrimeList.push_back(tuple<double, double>(11.0,29.0));
-  PrimeList.push_back(tuple<double, double>(11.0,31.0));
-
-  PrimeList.push_back(tuple<double, double>(11.0,37.0));
-  PrimeList.push_back(tuple<double, double>(11.0,41.0));
-  PrimeList.push_back(tuple<double, double>(11.0,43.0));
-  PrimeList.push_back(tuple<double, double>(11.0,47.0));
-  PrimeList.push_back(tuple<double, double>(11.0,53.0));
-  PrimeList.push_back(tuple<double, double>(11.0,59.0));
-
-  PrimeList.push_back(tuple<double, double>(11.0,61.0));
-  PrimeList.push_back(tuple<double, double>(11.0,67.0));
-  PrimeList.push_back(tuple<double, double>(11.0,71.0));
-  PrimeList.push_back(tuple<double, double>(11.0,73.0));
-  PrimeList.push_back(tuple<double, double>(11.0,79.0));
-  PrimeList.push_back(tuple<double, double>(11.0,83.0));
-
-  PrimeList.push_back(tuple<double, double>(11.0,89.0));
-  PrimeList.push_back(tuple<double, double>(11.0,97.0));
+  PrimePool = nullptr;
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,13));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,17));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,19));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,23));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,29));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,31));
+
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,37));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,41));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,43));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,47));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,53));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,59));
+
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,61));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,67));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,71));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,73));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,79));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,83));
+
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,89));
+  PrimeList.push_back(tuple<uint64_t, uint64_t>(11,97));
 
 }
 
+/**
+ * @brief Construct a new License Time Stamp Operation:: License Time Stamp Operation object with its own key schedule
+ * 
+ * With a prime pool, a key schedule is drawn from the pool for each license when it is issued (see LicensePrimePool::DrawKeySchedule), and the indexes of its primes
+ * are kept in the checksum file after the serial, covered by the checksum. The key schedule of such a license is looked up again from the same prime pool when it is inspected.
+ * A license without the indexes (e.g., issued without a prime pool) is inspected with the given key schedule.
+ * 
+ * @param encryptionFileName 
+ * The location and file name of the encrypted timestamp file
+ * @param checksumFileName 
+ * The location and file name of the timestamp checksum file (for file tamper check)
+ * @param LicenseDuration 
+ * The license duration (in days)
+ * @param KeySchedule 
+ * The prime pair used to encrypt each byte of the timestamp. An empty key schedule falls back to the default one.
+ * @param PrimePool 
+ * The prime pool to draw the key schedule of a new license from, and to look up the key schedule of an issued license in, or nullptr. It shall outlive the operation.
+ */
+
+LicenseTimeStampOperation::LicenseTimeStampOperation(string encryptionFileName, string checksumFileName, double LicenseDuration, const prime_list &KeySchedule, const LicensePrimePool *PrimePool)
+  : LicenseTimeStampOperation(encryptionFileName, checksumFileName, LicenseDuration) {
+  if (!KeySchedule.empty()) {
+    PrimeList = KeySchedule;
+  }
+  this->PrimePool = PrimePool;
+}
+
 
 /**
  * @brief 
  *  The first prime number in RSA encryption algorithm.
  *  TODO: In order to improve the entropy of the encryption algorithm, the first prime number can be randomized for each timestamp encryption operation.
+ *        A key schedule drawn from a prime pool (see LicensePrimePool::DrawKeySchedule) varies the primes for each license, but only the public exponent derived from them
+ *        is used (see GetPublicKey), so it does not add entropy yet.
  */
 const double FirstPrime = 11.0;
 /**
  * @brief 
  *  The second prime number in RSA encryption algorithm.
  *  TODO: In order to improve the entropy of the encryption algorithm, the second prime number can be randomized for each timestamp encryption operation.
+ *        See FirstPrime.
  */
 const double SecondPrime =  13.0;
 
@@ -140,12 +182,12 @@ const double SecondPrime =  13.0;
  * One of the integer to check GCD 
  * @param b 
  * The other integer to check GCD
- * @return int 
+ * @return uint64_t 
  * The GCD between @a and @b
  */
-int gcd(int a, int b)
+uint64_t gcd(uint64_t a, uint64_t b)
 {
-  int t;
+  uint64_t t;
   while (1)
   {
     t = a % b;
@@ -161,11 +203,18 @@ int gcd(int a, int b)
  * 
  * A function to retrieve the public key from RSA algorithm
  * 
+ * NOTE: the public key is the smallest exponent coprime to (p - 1) and (q - 1), which is a small odd number whatever the size of the primes,
+ * and the encrypted value is not reduced modulo N. So larger primes do not make the encrypted timestamp any harder to decrypt.
+ * 
+ * @param KeySchedule 
+ * The key schedule of the license
+ * @param index 
+ * The index of the byte in the timestamp
  * @return double 
  * The public key (i.e., the encryption key)
  */
 
-double LicenseTimeStampOperation::GetPublicKey(int index) {
+double LicenseTimeStampOperation::GetPublicKey(const prime_list &KeySchedule, int index) {
     
   //public key
   //e stands for encrypt
@@ -173,14 +222,18 @@ double LicenseTimeStampOperation::GetPublicKey(int index) {
 
   double track;
 
-  int  i = index % PrimeList.size();
+  int  i = index % KeySchedule.size();
 
-  double PHI = ((get<0>(PrimeList[i])) - 1) * ((get<1>(PrimeList[i])) - 1);
+  uint64_t p = get<0>(KeySchedule[i]);
+  uint64_t q = get<1>(KeySchedule[i]);
+
+  // phi(n) of two 64-bit primes does not fit into any integer type, so it is only kept in double for the upper bound of e.
+  double PHI = ((double)p - 1) * ((double)q - 1);
     
-  //for checking that 1 < e < phi(n) and gcd(e, phi(n)) = 1; i.e., e and phi(n) are coprime.
+  //for checking that 1 < e < phi(n) and gcd(e, phi(n)) = 1; i.e., e and phi(n) are coprime, which is checked exactly against (p - 1) and (q - 1) as integers.
   while (e < PHI)
   {
-    track = gcd(e, PHI);
+    track = (gcd(e, p - 1) == 1 && gcd(e, q - 1) == 1) ? 1 : 0;
     if (track == 1) {
       break;
     } else {
@@ -196,11 +249,17 @@ double LicenseTimeStampOperation::GetPublicKey(int index) {
  * 
  * A function to retrieve the private key from RSA algorithm
  * 
+ * @param KeySchedule 
+ * The key schedule of the license
+ * @param index 
+ * The index of the byte in the timestamp
+ * @param N 
+ * The product of the prime pair
  * @return double 
  * The private key
  */
 
-double LicenseTimeStampOperation::GetPrivateKey(int index, double &N) {
+double LicenseTimeStampOperation::GetPrivateKey(const prime_list &KeySchedule, int index, double &N) {
 
   //public key
   //e stands for encrypt
@@ -208,15 +267,18 @@ double LicenseTimeStampOperation::GetPrivateKey(int index, double &N) {
 
   double track;
 
-  int  i = index % PrimeList.size();
+  int  i = index % KeySchedule.size();
+
+  uint64_t p = get<0>(KeySchedule[i]);
+  uint64_t q = get<1>(KeySchedule[i]);
 
-  N = (get<0>(PrimeList[i])) * (get<1>(PrimeList[i]));
+  N = (double)p * (double)q;
 
-  double PHI = ((get<0>(PrimeList[index])) - 1) * ((get<1>(PrimeList[index])) - 1);
+  double PHI = ((double)p - 1) * ((double)q - 1);
     
-  //for checking that 1 < e < phi(n) and gcd(e, phi(n)) = 1; i.e., e and phi(n) are coprime.
+  //for checking that 1 < e < phi(n) and gcd(e, phi(n)) = 1; i.e., e and phi(n) are coprime, which is checked exactly against (p - 1) and (q - 1) as integers.
   while (e < PHI) {
-    track = gcd(e, PHI);
+    track = (gcd(e, p - 1) == 1 && gcd(e, q - 1) == 1) ? 1 : 0;
     if (track == 1) {
       break;
     } else {
@@ -292,6 +354,144 @@ inline bool IsFileExists (const string& name) {
   return (stat (name.c_str(), &buffer) == 0); 
 }
 
+/**
+ * @brief 
+ * A function to draw a new license serial, i.e., a random non-zero 64-bit number from the kernel random number generator.
+ * 
+ * @param Serial 
+ * The license serial
+ * @return OperationState 
+ * The operational state of drawing the serial
+ */
+static OperationState GenerateLicenseSerial(license_id &Serial) {
+  Serial = 0;
+  while (Serial == 0) {
+    if (getrandom(&Serial, sizeof(Serial), 0) != sizeof(Serial)) {
+      cout << "Unable to draw a license serial." << endl;
+      return TIMESTAMP_RETRIEVAL_ERROR;
+    }
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief 
+ * A function to turn a license serial into the text kept in the checksum file (16 hexadecimal digits).
+ */
+static string SerialToString(license_id Serial) {
+  ostringstream text;
+  text << hex << setw(LICENSE_SERIAL_DIGITS) << setfill('0') << Serial;
+  return text.str();
+}
+
+/**
+ * @brief 
+ * A function to parse a license serial from the checksum file.
+ * 
+ * @param Text 
+ * The serial text (16 hexadecimal digits)
+ * @param Serial 
+ * The license serial
+ * @return true
+ * It means that the serial is well-formed and non-zero
+ * @return false 
+ * It means that the serial is malformed
+ */
+static bool StringToSerial(const string &Text, license_id &Serial) {
+  if (Text.length() != LICENSE_SERIAL_DIGITS) {
+    return false;
+  }
+  for (char c : Text) {
+    if (!isxdigit((unsigned char)c)) {
+      return false;
+    }
+  }
+  Serial = strtoull(Text.c_str(), nullptr, 16);
+  return Serial != 0;
+}
+
+/**
+ * @brief 
+ * A function to turn the prime pool indexes of a key schedule into the text kept in the checksum file after the serial (8 hexadecimal digits for each index).
+ */
+static string KeyIndexesToString(const vector<uint32_t> &KeyIndexes) {
+  ostringstream text;
+  text << hex << setfill('0');
+  for (size_t i = 0; i < KeyIndexes.size(); i++) {
+    text << setw(KEY_INDEX_DIGITS) << KeyIndexes[i];
+  }
+  return text.str();
+}
+
+/**
+ * @brief 
+ * A function to parse the prime pool indexes of a key schedule from the checksum file.
+ * 
+ * @param Text 
+ * The indexes text (8 hexadecimal digits for each index, and a pair of indexes for each byte of the timestamp)
+ * @param KeyIndexes 
+ * The prime pool indexes
+ * @return true
+ * It means that the indexes text is well-formed
+ * @return false 
+ * It means that the indexes text is malformed
+ */
+static bool StringToKeyIndexes(const string &Text, vector<uint32_t> &KeyIndexes) {
+  KeyIndexes.clear();
+  if (Text.empty() || Text.length() % (2 * KEY_INDEX_DIGITS) != 0 || Text.length() > 2 * KEY_INDEX_DIGITS * SIZE) {
+    return false;
+  }
+  for (char c : Text) {
+    if (!isxdigit((unsigned char)c)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < Text.length(); i += KEY_INDEX_DIGITS) {
+    KeyIndexes.push_back(strtoul(Text.substr(i, KEY_INDEX_DIGITS).c_str(), nullptr, 16));
+  }
+  return true;
+}
+
+/**
+ * @brief 
+ * A function to compute the checksum of an encrypted timestamp, i.e., the checksum number of each encrypted byte.
+ * 
+ * The checksum of a license with a serial covers the serial, and the prime pool indexes of its key schedule if any: the checksum number of each byte is offset by a byte (plus one)
+ * of the SHA-256 digest of their text, so neither of them can be changed or removed from the checksum file without the checksum being recomputed.
+ * 
+ * @param Content 
+ * The encrypted timestamp
+ * @param length 
+ * The number of encrypted values
+ * @param Serial 
+ * The license serial, or 0 for a license issued before the serial was introduced (whose checksum only covers the encrypted timestamp)
+ * @param KeyIndexes 
+ * The prime pool indexes of the key schedule, or none for a license issued without a prime pool
+ * @return string 
+ * The checksum
+ */
+static string ComputeCheckSum(const double *Content, size_t length, license_id Serial, const vector<uint32_t> &KeyIndexes) {
+  long int checksum[SIZE];
+  license_digest digest = {};
+
+  if (Serial != 0) {
+    string text = SerialToString(Serial);
+    if (!KeyIndexes.empty()) {
+      text += "\n" + KeyIndexesToString(KeyIndexes);
+    }
+    digest = ComputeDigest(text.data(), text.length());
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    checksum[i] = ceil(fmod(Content[i], CHECKSUM_SIZE));
+    if (Serial != 0) {
+      checksum[i] = (checksum[i] + digest[i % DIGEST_SIZE] + 1) % CHECKSUM_SIZE;
+    }
+  }
+
+  return convertToString(checksum, length);
+}
+
 /**
  * @brief 
  * A method to create  the timestamp file when the software license started.
@@ -311,9 +511,6 @@ OperationState LicenseTimeStampOperation::CreateTimeStampFile(double* EncryptedO
 {
   OperationState ret = SUCCESS;
 
-  char temp;
-  int i;
-
   string inStr;
 
   if (EncryptedOut == nullptr) {
@@ -334,17 +531,70 @@ OperationState LicenseTimeStampOperation::CreateTimeStampFile(double* EncryptedO
     cout << "message to encrypt: " << inStr <<endl;
   }
 
-  int lengthOfString = inStr.length();
+  // each license is given its own serial, as the encrypted timestamp only depends on the timestamp and the key schedule.
+  license_id serial = 0;
+  if ((ret = GenerateLicenseSerial(serial)) != SUCCESS) {
+    return ret;
+  }
 
-  long int hashCode = 0;
+  size_t length = 0;
+  vector<uint32_t> keyIndexes;
+
+  if ((ret = EncryptTimeStamp(inStr, serial, EncryptedOut, EncryptedCheckSum, keyIndexes, length)) != SUCCESS) {
+    return ret;
+  }
+
+  return writeIntoFile(EncryptedOut,EncryptedCheckSum, serial, keyIndexes, length);
+}
+
+/**
+ * @brief 
+ * A method to encrypt a timestamp string with the key schedule of this operation, without writing any file.
+ * With a prime pool, a new key schedule is drawn from the pool for each encryption instead.
+ * 
+ * It is shared by the timestamp file creation and the license migration, in which the decrypted timestamp of an existing license is encrypted again with a new key schedule.
+ * 
+ * @param TimeStamp 
+ * The timestamp string to be encrypted
+ * @param Serial 
+ * The license serial, which the checksum covers (see GetLicenseId)
+ * @param EncryptedOut 
+ * The encrypted array in double type of values (at least SIZE elements)
+ * @param EncryptedCheckSum 
+ * The checksum on the encrypted timestamp, the serial and the prime pool indexes
+ * @param KeyIndexes 
+ * The prime pool indexes of the drawn key schedule, to be kept in the checksum file, or none without a prime pool
+ * @param length 
+ * The number of encrypted values
+ * @return OperationState 
+ * The operational state of the encryption
+ */
+
+OperationState LicenseTimeStampOperation::EncryptTimeStamp(const string &TimeStamp, license_id Serial, double* EncryptedOut, string &EncryptedCheckSum, vector<uint32_t> &KeyIndexes, size_t &length)
+{
+  OperationState ret = SUCCESS;
+  int i;
+
+  length = 0;
+  KeyIndexes.clear();
+
+  if (EncryptedOut == nullptr || TimeStamp.empty() || TimeStamp.length() > SIZE || Serial == 0) {
+    return INVALID_PARAMETER;
+  }
+
+  prime_list drawnSchedule;
+  if (PrimePool != nullptr && (ret = PrimePool->DrawKeySchedule(KeyIndexes, drawnSchedule)) != SUCCESS) {
+    return ret;
+  }
+  const prime_list &keySchedule = PrimePool != nullptr ? drawnSchedule : PrimeList;
+
+  int lengthOfString = TimeStamp.length();
 
-  double en[SIZE];
- 
   // declaring character array
   char inputCharArray[lengthOfString + 1];
  
   // copying the contents of the string to char array (conversion)
-  strcpy(inputCharArray, inStr.c_str());
+  strcpy(inputCharArray, TimeStamp.c_str());
 
   if (DEBUG) {
     cout << "Input string is: " <<endl;
@@ -354,29 +604,22 @@ OperationState LicenseTimeStampOperation::CreateTimeStampFile(double* EncryptedO
     }
   }
 
-  
-
-  long int en_display[SIZE];
-
-  
   for (i=0;i < lengthOfString; i++) {
 
-    double publicKey = GetPublicKey(i);
+    double publicKey = GetPublicKey(keySchedule, i);
     // encrypt the timestamp string using the RSA public key before it was written into a file - address the code test requirement 1.1
-    en[i] = pow(inputCharArray[i],publicKey);
     // save the encrypted timestamp as the output fo this function so that it can be used later - address the code test requirement 1.2
-    EncryptedOut[i] = en[i];
+    EncryptedOut[i] = pow(inputCharArray[i],publicKey);
 
     if (DEBUG) {
-      cout<< "EncryptedArray[" << i << "] = " << en[i] <<endl;
+      cout<< "EncryptedArray[" << i << "] = " << EncryptedOut[i] <<endl;
     }
-    
-    en_display[i] = ceil(fmod(en[i], CHECKSUM_SIZE));
   }
   
-  EncryptedCheckSum = convertToString(en_display,lengthOfString);
+  length = lengthOfString;
+  EncryptedCheckSum = ComputeCheckSum(EncryptedOut, length, Serial, KeyIndexes);
 
-  return writeIntoFile(en,EncryptedCheckSum, i);
+  return SUCCESS;
 }
 
 /**
@@ -388,21 +631,25 @@ OperationState LicenseTimeStampOperation::CreateTimeStampFile(double* EncryptedO
  * The content (in array of double) to be written into a file
  * @param checksum
  * The checksum of the timestamp string 
+ * @param Serial 
+ * The license serial, written after the checksum (see GetLicenseId)
+ * @param KeyIndexes 
+ * The prime pool indexes of the key schedule, written after the serial if any
  * @param length 
  * The length of the content 
  * @return OperationState 
  * The operational state of writing the encrypted timestamp, as well as its checksum,  in a file.
  */
-OperationState LicenseTimeStampOperation::writeIntoFile (double *Content, string checksum, size_t length) {
+OperationState LicenseTimeStampOperation::writeIntoFile (double *Content, string checksum, license_id Serial, const vector<uint32_t> &KeyIndexes, size_t length) {
 
-  if (EncryptionFileName.empty() || CheckSumFileName.empty()  || checksum.empty() || Content == nullptr || length == 0) {
+  if (EncryptionFileName.empty() || CheckSumFileName.empty()  || checksum.empty() || Content == nullptr || length == 0 || Serial == 0) {
     return INVALID_PARAMETER;
   }
 
   ofstream enfile (EncryptionFileName);
   if (enfile.is_open())
   {
-    for(int count = 0; count < length; count++){
+    for(size_t count = 0; count < length; count++){
       enfile << setprecision(numeric_limits<double>::digits10 + 2) << Content[count] << endl ;
     }
    
@@ -417,6 +664,10 @@ OperationState LicenseTimeStampOperation::writeIntoFile (double *Content, string
 
   if (checksumFile.is_open()) {
     checksumFile << checksum << endl;
+    checksumFile << SerialToString(Serial) << endl;
+    if (!KeyIndexes.empty()) {
+      checksumFile << KeyIndexesToString(KeyIndexes) << endl;
+    }
     checksumFile.close();
 
   } else {
@@ -427,6 +678,176 @@ OperationState LicenseTimeStampOperation::writeIntoFile (double *Content, string
   return SUCCESS;
 }
 
+/**
+ * @brief 
+ * A function to write the content into a file, and flush it to the disk before returning.
+ * 
+ * @param name 
+ * The target file name (with full path)
+ * @param content 
+ * The content to be written
+ * @return OperationState 
+ * The operational state of the write
+ */
+OperationState WriteFileDurably(const string &name, const string &content) {
+  int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    cout << "Unable to open file, " << name << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  size_t written = 0;
+  while (written < content.length()) {
+    ssize_t bytes = write(fd, content.data() + written, content.length() - written);
+    if (bytes <= 0) {
+      break;
+    }
+    written += bytes;
+  }
+
+  bool failed = written != content.length() || fsync(fd) != 0;
+  failed = close(fd) != 0 || failed;
+  if (failed) {
+    cout << "Unable to write file, " << name << endl;
+    return FILE_FAIL_OPEN;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief 
+ * A function to flush the directory of a file to the disk, so that a file created or renamed in it is durable.
+ * 
+ * @param FileName 
+ * The file name (with full path), whose directory is flushed
+ * @return OperationState 
+ * The operational state of the flush
+ */
+OperationState SyncParentDirectory(const string &FileName) {
+  size_t slash = FileName.find_last_of('/');
+  string directory = slash == string::npos ? "." : (slash == 0 ? "/" : FileName.substr(0, slash));
+
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return FILE_FAIL_OPEN;
+  }
+  bool failed = fsync(fd) != 0;
+  close(fd);
+
+  return failed ? FILE_FAIL_OPEN : SUCCESS;
+}
+
+/**
+ * @brief 
+ * A function to replace a file atomically: the content is written into a temporary file next to it ("<file name>.tmp"), flushed to the disk, and renamed over the file.
+ * The directory is flushed after the rename, so the new file is the one found after a crash.
+ * 
+ * @param FileName 
+ * The target file name (with full path)
+ * @param Content 
+ * The content to be written
+ * @return OperationState 
+ * The operational state of the replacement
+ */
+OperationState WriteFileAtomically(const string &FileName, const string &Content) {
+  OperationState ret = SUCCESS;
+  string temporaryFileName = FileName + STAGED_FILE_SUFFIX;
+
+  if (FileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  if ((ret = WriteFileDurably(temporaryFileName, Content)) != SUCCESS || rename(temporaryFileName.c_str(), FileName.c_str()) != 0) {
+    cout << "Unable to write file, " << FileName << endl;
+    unlink(temporaryFileName.c_str());
+    return ret != SUCCESS ? ret : FILE_FAIL_OPEN;
+  }
+
+  return SyncParentDirectory(FileName);
+}
+
+/**
+ * @brief 
+ * A method to write an encrypted timestamp and its checksum into the temporary files next to the timestamp file and the checksum file ("<file name>.tmp"), flushed to the disk.
+ * The original files are not touched until CommitTimeStampFile is called, so they can be replaced (e.g., by a license migration) without a window in which a crash leaves a half-written license.
+ * 
+ * @param EncryptedOut 
+ * The encrypted timestamp (see EncryptTimeStamp)
+ * @param EncryptedCheckSum 
+ * The checksum on the encrypted timestamp
+ * @param Serial 
+ * The license serial (see GetLicenseId), which is kept when a license is re-encrypted
+ * @param KeyIndexes 
+ * The prime pool indexes of the key schedule (see EncryptTimeStamp), or none
+ * @param length 
+ * The number of encrypted values
+ * @return OperationState 
+ * The operational state of staging the files
+ */
+OperationState LicenseTimeStampOperation::StageTimeStampFile(const double* EncryptedOut, const string &EncryptedCheckSum, license_id Serial, const vector<uint32_t> &KeyIndexes, size_t length) {
+  OperationState ret = SUCCESS;
+
+  if (EncryptionFileName.empty() || CheckSumFileName.empty() || EncryptedCheckSum.empty() || EncryptedOut == nullptr || length == 0 || Serial == 0) {
+    return INVALID_PARAMETER;
+  }
+
+  // the same format as writeIntoFile.
+  ostringstream content;
+  for (size_t count = 0; count < length; count++) {
+    content << setprecision(numeric_limits<double>::digits10 + 2) << EncryptedOut[count] << endl;
+  }
+
+  if ((ret = WriteFileDurably(EncryptionFileName + STAGED_FILE_SUFFIX, content.str())) != SUCCESS) {
+    return ret;
+  }
+
+  string checksum = EncryptedCheckSum + "\n" + SerialToString(Serial) + "\n";
+  if (!KeyIndexes.empty()) {
+    checksum += KeyIndexesToString(KeyIndexes) + "\n";
+  }
+
+  return WriteFileDurably(CheckSumFileName + STAGED_FILE_SUFFIX, checksum);
+}
+
+/**
+ * @brief 
+ * A method to replace the timestamp file and the checksum file by the staged files (see StageTimeStampFile), and flush the directory entries to the disk.
+ * 
+ * A staged file which does not exist any more has already replaced its original file, so the method can be called again to complete an interrupted replacement.
+ * 
+ * @return OperationState 
+ * The operational state of the replacement
+ */
+OperationState LicenseTimeStampOperation::CommitTimeStampFile() {
+
+  if (EncryptionFileName.empty() || CheckSumFileName.empty()) {
+    return INVALID_PARAMETER;
+  }
+
+  string names[2] = {EncryptionFileName, CheckSumFileName};
+
+  for (int i = 0; i < 2; i++) {
+    string staged = names[i] + STAGED_FILE_SUFFIX;
+    if (IsFileExists(staged) && rename(staged.c_str(), names[i].c_str()) != 0) {
+      cout << "Unable to replace file, " << names[i] << endl;
+      return FILE_FAIL_OPEN;
+    }
+  }
+
+  // the renames are only durable once their directories are flushed.
+  SyncParentDirectory(EncryptionFileName);
+  if (EncryptionFileName.substr(0, EncryptionFileName.find_last_of('/') + 1) != CheckSumFileName.substr(0, CheckSumFileName.find_last_of('/') + 1)) {
+    SyncParentDirectory(CheckSumFileName);
+  }
+
+  if (!IsFileExists(EncryptionFileName) || !IsFileExists(CheckSumFileName)) {
+    return FILE_NOT_EXIST;
+  }
+
+  return SUCCESS;
+}
+
 /**
  * @brief 
  * 
@@ -439,11 +860,22 @@ OperationState LicenseTimeStampOperation::writeIntoFile (double *Content, string
  * @param length 
  * 
  * The size of the read content (in an array of doubles)
+ * @param Serial 
+ * 
+ * The license serial kept in the checksum file, or 0 for a license issued before the serial was introduced
+ * @param KeyIndexes 
+ * 
+ * The prime pool indexes of the key schedule kept in the checksum file, or none for a license issued without a prime pool
  * @return OperationState 
  * 
  * The operational state of reading the encrypted timestamp, as well as its checksum,  from a file.
+ * TIMESTAMP_TAMPERED if the checksum does not match the encrypted timestamp, the serial and the indexes, in which case the serial read from the checksum file, if well-formed, is returned as it is.
  */
-OperationState LicenseTimeStampOperation::readFromFile (double* Content, size_t &length) {
+OperationState LicenseTimeStampOperation::readFromFile (double* Content, size_t &length, license_id &Serial, vector<uint32_t> &KeyIndexes) {
+
+  Serial = 0;
+  length = 0;
+  KeyIndexes.clear();
 
   if (EncryptionFileName.empty() || CheckSumFileName.empty() || Content == nullptr) {
     return INVALID_PARAMETER;
@@ -457,12 +889,17 @@ OperationState LicenseTimeStampOperation::readFromFile (double* Content, size_t
 
   ifstream decfile(EncryptionFileName);
   
-  int i = 0;
+  size_t i = 0;
 
   if (decfile.is_open())
   {
     
     for (double a; decfile >> a;) {
+      // a timestamp file with more values than any timestamp has been tampered with.
+      if (i == SIZE) {
+        cout << "oversized timestamp file. The license file has been tampered with." << endl;
+        return TIMESTAMP_TAMPERED;
+      }
       Content[i] = a;
       i++;
     }
@@ -479,23 +916,29 @@ OperationState LicenseTimeStampOperation::readFromFile (double* Content, size_t
 
   ifstream checksumfile (CheckSumFileName);
   string ReadChecksum = "";
+  string ReadSerial = "";
+  string ReadKeyIndexes = "";
 
   if (checksumfile.is_open()) {
          
-    checksumfile >> ReadChecksum;
+    checksumfile >> ReadChecksum >> ReadSerial >> ReadKeyIndexes;
     checksumfile.close();
 
   } else {
     return FILE_FAIL_OPEN;
   }
 
-  long int calculatedCheckSum [SIZE];
-
-  for (i=0;i < length; i++) {
-    calculatedCheckSum[i] = ceil(fmod(Content[i], CHECKSUM_SIZE));
+  if (!ReadSerial.empty() && !StringToSerial(ReadSerial, Serial)) {
+    cout << "malformed license serial: " << ReadSerial << ". The license file has been tampered with." << endl;
+    return TIMESTAMP_TAMPERED;
+  }
+  if (!ReadKeyIndexes.empty() && (Serial == 0 || !StringToKeyIndexes(ReadKeyIndexes, KeyIndexes))) {
+    cout << "malformed key schedule indexes: " << ReadKeyIndexes << ". The license file has been tampered with." << endl;
+    return TIMESTAMP_TAMPERED;
   }
 
-  string StrCalculatedCheckSum = convertToString(calculatedCheckSum,length);
+  // the checksum of a license with a serial covers the serial and the indexes, so a license whose serial or indexes were changed or removed does not match its checksum.
+  string StrCalculatedCheckSum = ComputeCheckSum(Content, length, Serial, KeyIndexes);
 
   // if the timestamp file cannot be decrypted correctly with the expected checksum,  return the corresponding error code - address the code test requirement 2.2
   if (StrCalculatedCheckSum != ReadChecksum) {
@@ -526,16 +969,27 @@ OperationState LicenseTimeStampOperation::InspectTimeStamp(string &outStr)
 {
   OperationState ret = SUCCESS;
 
-  int i;
+  size_t i;
 
   double localen[SIZE];
   size_t length;
+  license_id serial;
+  vector<uint32_t> keyIndexes;
 
-  if ((ret = readFromFile (localen,length)) != SUCCESS) {
+  if ((ret = readFromFile (localen,length,serial,keyIndexes)) != SUCCESS) {
     outStr = "";
     return ret;
   }
 
+  // a license issued with a key schedule drawn from a prime pool is decrypted with that key schedule, looked up from the pool by the indexes kept in its checksum file.
+  prime_list lookedUpSchedule;
+  if (!keyIndexes.empty() && (PrimePool == nullptr || PrimePool->LookupKeySchedule(keyIndexes, lookedUpSchedule) != SUCCESS)) {
+    cout << "The key schedule of the license cannot be looked up without its prime pool." << endl;
+    outStr = "";
+    return TIMESTAMP_RETRIEVAL_ERROR;
+  }
+  const prime_list &keySchedule = keyIndexes.empty() ? PrimeList : lookedUpSchedule;
+
  
 
   double decryptedMsg[SIZE];
@@ -545,7 +999,7 @@ OperationState LicenseTimeStampOperation::InspectTimeStamp(string &outStr)
   double N = 1.0;
 
   for (i=0;i < length; i++){
-    double privateKey = GetPrivateKey(i,N);
+    double privateKey = GetPrivateKey(keySchedule,i,N);
     
     cout << "Inspect timestamp: N[" << i << "] = " << N << endl;
     
@@ -555,7 +1009,8 @@ OperationState LicenseTimeStampOperation::InspectTimeStamp(string &outStr)
 
     decryptedMsg[i] = fmod(decryptedMsg[i],N);
 
-    de_display[i] = ceil(decryptedMsg[i]);
+    // round to the nearest character, as the root computed in double precision can be slightly above or below the original character.
+    de_display[i] = lround(decryptedMsg[i]);
 
     char temp = de_display[i];
 
@@ -581,7 +1036,10 @@ OperationState LicenseTimeStampOperation::InspectTimeStamp(string &outStr)
 time_t String2DateTime(string dateTime)
 {
 
-  tm ltm;
+  tm ltm = {};
+
+  // let mktime() decide whether the daylight saving time is in effect
+  ltm.tm_isdst = -1;
 
   // empty dataTime string handling.
   if (dateTime.empty()) {
@@ -603,14 +1061,25 @@ time_t String2DateTime(string dateTime)
   // string to char array
   strcpy(char_array, dateTime.c_str());
 
-  char* pch;
-  pch = strtok(char_array, "TZ-:");
-  ltm.tm_year = atoi(pch) - 1900; //get the year value
-  ltm.tm_mon = atoi(strtok(NULL, "TZ-:")) - 1;  //get the month value
-  ltm.tm_mday = atoi(strtok(NULL, "TZ-:")); //get the day value
-  ltm.tm_hour = atoi(strtok(NULL, "TZ-:")); //get the hour value
-  ltm.tm_min = atoi(strtok(NULL, "TZ-:")); //get the min value
-  ltm.tm_sec = atoi(strtok(NULL, "TZ-:")); //get the sec value
+  // strtok_r() is used instead of strtok() so that the timestamps can be parsed from multiple threads at the same time.
+  char* context = nullptr;
+  char* fields[6];
+
+  fields[0] = strtok_r(char_array, "TZ-:", &context);
+  for (int i = 1; i < 6; i++) {
+    fields[i] = fields[i - 1] != nullptr ? strtok_r(NULL, "TZ-:", &context) : nullptr;
+  }
+  // a malformed timestamp string cannot be converted.
+  if (fields[5] == nullptr) {
+    return (time_t)(-1);
+  }
+
+  ltm.tm_year = atoi(fields[0]) - 1900; //get the year value
+  ltm.tm_mon = atoi(fields[1]) - 1;  //get the month value
+  ltm.tm_mday = atoi(fields[2]); //get the day value
+  ltm.tm_hour = atoi(fields[3]); //get the hour value
+  ltm.tm_min = atoi(fields[4]); //get the min value
+  ltm.tm_sec = atoi(fields[5]); //get the sec value
 
   if (DEBUG) {
     cout << "Year: "<< ltm.tm_year << endl;
@@ -663,8 +1132,9 @@ bool LicenseTimeStampOperation::IsTimeStampExpired() {
     double difference = difftime(NowTime, StartTime) / (60 * 60 * 24);
     
     if (DEBUG) {
-      cout <<"Licnese Start Time: " <<ctime(&StartTime) << endl;
-      cout <<"Now time: " <<ctime(&NowTime) << endl;
+      char timeBuffer[26];
+      cout <<"Licnese Start Time: " <<ctime_r(&StartTime, timeBuffer) << endl;
+      cout <<"Now time: " <<ctime_r(&NowTime, timeBuffer) << endl;
     }
     
     // print the license duration (in days), compared to the elapsed time (in days) 
@@ -677,6 +1147,136 @@ bool LicenseTimeStampOperation::IsTimeStampExpired() {
   return ret;
 
  }
+ /**
+  * @brief 
+  * An API to check if the timestamp has expired or the license has been revoked.
+  * 
+  * The revocation list is only checked for a license which has not expired, and most of the licenses are not revoked, so the common case costs a few cache misses in the Bloom filter of the revocation list.
+  * 
+  * @param RevocationList 
+  * The revocation list to check the license identity against
+  * @return true 
+  * The timestamp has expired, or the license has been revoked
+  * @return false 
+  * The timestamp has not expired and the license has not been revoked
+  */
+
+bool LicenseTimeStampOperation::IsTimeStampExpired(const LicenseRevocationList &RevocationList) {
+
+  license_id id = 0;
+
+  if (IsTimeStampExpired() || GetLicenseId(id) != SUCCESS) {
+    return true;
+  }
+
+  if (RevocationList.IsRevoked(id)) {
+    cout << "License " << id << " has been revoked." << endl;
+    return true;
+  }
+
+  return false;
+}
+
+ /**
+  * @brief 
+  * An API to retrieve the license identity, i.e., the serial drawn at random when the license was issued and kept in the checksum file after the checksum.
+  * 
+  * The serial is only returned once the checksum, which covers it, matches the encrypted timestamp. A license issued before the serial was introduced
+  * is identified by the first 8 bytes of the SHA-256 digest of its checksum instead (which is the same for all the licenses issued in the same second with the same key schedule).
+  * 
+  * @param Id 
+  * The license identity. If the license has been tampered with, it is the serial claimed by the checksum file (or 0), which is only good to flag the license.
+  * @return OperationState 
+  * The operational state of the identity retrieval
+  */
+
+OperationState LicenseTimeStampOperation::GetLicenseId(license_id &Id)
+{
+  OperationState ret = SUCCESS;
+  double content[SIZE];
+  size_t length = 0;
+  vector<uint32_t> keyIndexes;
+
+  Id = 0;
+
+  if ((ret = readFromFile(content, length, Id, keyIndexes)) != SUCCESS || Id != 0) {
+    return ret;
+  }
+
+  if (length == 0) {
+    return TIMESTAMP_RETRIEVAL_ERROR;
+  }
+
+  string checksum = ComputeCheckSum(content, length, 0, keyIndexes);
+  license_digest digest = ComputeDigest(checksum.data(), checksum.length());
+  for (int i = 0; i < 8; i++) {
+    Id = (Id << 8) | digest[i];
+  }
+
+  return SUCCESS;
+}
+
+ /**
+  * @brief 
+  * An API to check if a decrypted timestamp string is well-formed (i.e., "YYYY-MM-DDTHH:MM:SSZ", as written by ConvertcurrentDateToString).
+  * A license decrypted with a wrong key schedule, or read while it is being written, is not.
+  * 
+  * @param TimeStamp 
+  * The decrypted timestamp string
+  * @return true 
+  * It means that the timestamp string is well-formed
+  * @return false 
+  * It means that the timestamp string is malformed
+  */
+
+bool LicenseTimeStampOperation::IsWellFormedTimeStamp(const string &TimeStamp)
+{
+  const char *pattern = "dddd-dd-ddTdd:dd:ddZ";
+
+  if (TimeStamp.length() != TIMESTAMP_LENGTH) {
+    return false;
+  }
+  for (size_t i = 0; i < TIMESTAMP_LENGTH; i++) {
+    if (pattern[i] == 'd' ? !isdigit((unsigned char)TimeStamp[i]) : TimeStamp[i] != pattern[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ /**
+  * @brief 
+  * An API to retrieve the license start time and the expiry deadline (i.e., the start time plus the license duration), so that the expiry can be checked later without decrypting the timestamp file again.
+  * 
+  * @param StartTime 
+  * The license start time
+  * @param Deadline 
+  * The license expiry deadline
+  * @return OperationState 
+  * The operational state of the deadline retrieval
+  */
+
+OperationState LicenseTimeStampOperation::GetExpiryDeadline(time_t &StartTime, time_t &Deadline)
+{
+  OperationState ret = SUCCESS;
+  string InputDateTime = "";
+
+  StartTime = (time_t)(-1);
+  Deadline = (time_t)(-1);
+
+  if ((ret = InspectTimeStamp(InputDateTime)) != SUCCESS) {
+    return ret;
+  }
+
+  if (InputDateTime.empty() || (StartTime = String2DateTime(InputDateTime)) == (time_t)(-1)) {
+    return TIMESTAMP_RETRIEVAL_ERROR;
+  }
+
+  Deadline = StartTime + (time_t)(LicenseDurationInDays * 60 * 60 * 24);
+
+  return SUCCESS;
+}
+
  /**
   * @brief 
   * A function to convert a time_t object to a string
@@ -693,7 +1293,9 @@ OperationState LicenseTimeStampOperation::ConvertcurrentDateToString(string &dat
 
   time_t now = system_clock::to_time_t(now_time);
 
-  tm *ltm = localtime(&now);
+  // localtime_r() is used instead of localtime() so that the timestamp can be created from multiple threads at the same time.
+  tm localTime;
+  tm *ltm = localtime_r(&now, &localTime);
 
   if (ltm == nullptr) {
     cout << " failed to read the system time" << endl;
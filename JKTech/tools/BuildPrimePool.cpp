@@ -0,0 +1,47 @@
+/**
+ * @file BuildPrimePool.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief 
+ * 
+ * The offline builder of the prime pool file for the per-license key randomization (see LicensePrimePool).
+ * 
+ * Usage: BuildPrimePool <prime pool file> [number of primes (default 1048576)] [bits of each prime (default 64)]
+ * 
+ * @version 0.1
+ * @date 2022-03-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+#include "../include/LicensePrimePool.h"
+
+using namespace std;
+using namespace std::chrono;
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <prime pool file> [number of primes] [bits of each prime]" << endl;
+        return -1;
+    }
+
+    string poolFile = argv[1];
+    size_t primeCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : (1 << 20);
+    int primeBits = argc > 3 ? atoi(argv[3]) : 64;
+
+    steady_clock::time_point start = steady_clock::now();
+    OperationState result = LicensePrimePool::BuildPrimePoolFile(poolFile, primeCount, primeBits);
+    double seconds = duration<double>(steady_clock::now() - start).count();
+
+    if (result != SUCCESS) {
+        cout << "Fail to build the prime pool. error: " << result << endl;
+        return -1;
+    }
+
+    cout << "Built a pool of " << primeCount << " " << primeBits << "-bit primes in " << seconds << " seconds: " << poolFile << endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file ConcurrentExpiryBench.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief 
+ * 
+ * A benchmark of the lock-free expiry check in the concurrent mode (LicenseConcurrentVerifier).
+ * 
+ * The reader threads check the expiry as fast as they can, while a single verifier publishes a new snapshot periodically.
+ * The throughput is reported for 1, 2, 4, ... up to the maximal number of reader threads, together with its scaling against a single reader thread.
+ * 
+ * Usage: ConcurrentExpiryBench [max reader threads (default 64)] [milliseconds per run (default 500)]
+ * 
+ * @version 0.1
+ * @date 2022-03-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../include/LicenseTimeStamp.h"
+#include "../include/LicenseConcurrentVerifier.h"
+#include "ToolConsole.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief 
+ * The interval (in milliseconds) between two snapshots published by the verifier during the benchmark.
+ */
+const int REFRESH_INTERVAL_MS = 10;
+
+int main(int argc, char *argv[])
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+    int runMs = argc > 2 ? atoi(argv[2]) : 500;
+
+    if (maxThreads < 1 || runMs < 1) {
+        cout << "Usage: " << argv[0] << " [max reader threads] [milliseconds per run]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/ConcurrentExpiryBench.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string encryptedFile = string(dirTemplate) + "/Encrypted.txt";
+    string checksumFile = string(dirTemplate) + "/checksum.txt";
+
+    MutedConsole console;
+
+    LicenseTimeStampOperation issuer(encryptedFile, checksumFile, 30);
+    double encryptedOut[SIZE];
+    string checksum;
+    OperationState result = issuer.CreateTimeStampFile(encryptedOut, checksum);
+
+    LicenseConcurrentVerifier verifier(encryptedFile, checksumFile, 30);
+    OperationState refreshed = verifier.Refresh();
+
+    console.Restore();
+
+    if (result != SUCCESS || refreshed != SUCCESS) {
+        cout << "Fail to prepare the license. error: " << issuer.OperationStateToString(result != SUCCESS ? result : refreshed) << endl;
+        return -1;
+    }
+
+    cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+    cout << setw(8) << "threads" << setw(16) << "checks/sec" << setw(10) << "scaling" << setw(12) << "snapshots" << endl;
+
+    double singleThreadRate = 0;
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        atomic<bool> running(true);
+        atomic<unsigned long> totalChecks(0);
+        atomic<unsigned long> expiredChecks(0);
+        vector<thread> readers;
+
+        console.Mute();
+
+        VerifiedLicenseSnapshot before;
+        verifier.GetSnapshot(before);
+
+        for (int t = 0; t < threads; t++) {
+            readers.push_back(thread([&]() {
+                unsigned long checks = 0;
+                unsigned long expired = 0;
+                time_t now = time(nullptr);
+
+                while (running.load(memory_order_relaxed)) {
+                    for (int i = 0; i < 1024; i++) {
+                        expired += verifier.IsTimeStampExpired(now) ? 1 : 0;
+                    }
+                    checks += 1024;
+                }
+                totalChecks += checks;
+                expiredChecks += expired;
+            }));
+        }
+
+        // the single verifier keeps publishing new snapshots while the reader threads are checking the expiry.
+        steady_clock::time_point start = steady_clock::now();
+        steady_clock::time_point end = start + milliseconds(runMs);
+        while (steady_clock::now() < end) {
+            this_thread::sleep_for(milliseconds(REFRESH_INTERVAL_MS));
+            verifier.Refresh();
+        }
+        running = false;
+        for (size_t t = 0; t < readers.size(); t++) {
+            readers[t].join();
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+
+        VerifiedLicenseSnapshot after;
+        verifier.GetSnapshot(after);
+
+        console.Restore();
+
+        double rate = totalChecks / seconds;
+        if (threads == 1) {
+            singleThreadRate = rate;
+        }
+        cout << setw(8) << threads << setw(16) << fixed << setprecision(0) << rate
+             << setw(10) << setprecision(2) << rate / singleThreadRate
+             << setw(12) << after.Generation - before.Generation << endl;
+
+        if (expiredChecks != 0) {
+            cout << "unexpected expiry reported " << expiredChecks << " time(s)." << endl;
+        }
+    }
+
+    unlink(encryptedFile.c_str());
+    unlink(checksumFile.c_str());
+    rmdir(dirTemplate);
+
+    return 0;
+}
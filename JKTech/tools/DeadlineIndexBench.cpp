@@ -0,0 +1,148 @@
+/**
+ * @file DeadlineIndexBench.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A benchmark of the deadline index.
+ *
+ * It indexes the given number of licenses with random deadlines over the next year, compacts the index, then renews a share of the licenses
+ * (i.e., the updates stay in the journal), and reports the latency of "expiring within 7 days" queries, checked against a brute-force scan.
+ *
+ * Usage: DeadlineIndexBench [number of licenses (default 1000000)] [number of renewals (default 10000)]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../include/LicenseDeadlineIndex.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const int Queries = 100;
+const double QueryDays = 7;
+
+/**
+ * @brief
+ * A function to time the "expiring within 7 days" queries, and check their results against a brute-force scan of the expected deadlines.
+ */
+static bool RunQueries(const LicenseDeadlineIndex &index, const unordered_map<license_id, time_t> &deadlines, const char *label)
+{
+    vector<license_id> ids;
+    double seconds = 0;
+
+    for (int i = 0; i < Queries; i++) {
+        steady_clock::time_point start = steady_clock::now();
+        index.QueryExpiringWithin(QueryDays, ids);
+        seconds += duration<double>(steady_clock::now() - start).count();
+    }
+
+    time_t now = time(nullptr);
+    time_t until = now + (time_t)(QueryDays * 60 * 60 * 24);
+    size_t expected = 0;
+    for (unordered_map<license_id, time_t>::const_iterator it = deadlines.begin(); it != deadlines.end(); ++it) {
+        expected += it->second >= now && it->second <= until ? 1 : 0;
+    }
+
+    // the results are ordered by the deadlines, and each license appears once.
+    bool ordered = true;
+    for (size_t i = 1; i < ids.size(); i++) {
+        ordered = ordered && deadlines.at(ids[i - 1]) <= deadlines.at(ids[i]);
+    }
+    vector<license_id> unique(ids);
+    sort(unique.begin(), unique.end());
+    bool correct = ordered && adjacent_find(unique.begin(), unique.end()) == unique.end() && expected == ids.size();
+
+    cout << label << ": " << ids.size() << " licenses expiring within " << defaultfloat << QueryDays << " days, "
+         << fixed << setprecision(3) << seconds * 1e3 / Queries << " ms per query" << (correct ? "" : " (MISMATCH)") << endl;
+    return correct;
+}
+
+int main(int argc, char *argv[])
+{
+    int licenses = argc > 1 ? atoi(argv[1]) : 1000000;
+    int renewals = argc > 2 ? atoi(argv[2]) : 10000;
+
+    if (licenses < 1 || renewals < 0 || renewals > licenses) {
+        cout << "Usage: " << argv[0] << " [number of licenses] [number of renewals]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/DeadlineIndexBench.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string indexFile = string(dirTemplate) + "/deadlines.idx";
+
+    mt19937_64 random(20220301);
+    time_t now = time(nullptr);
+    unordered_map<license_id, time_t> deadlines;
+    vector<license_id> ids;
+    deadlines.reserve(licenses);
+    ids.reserve(licenses);
+
+    LicenseDeadlineIndex index;
+    bool correct = index.Open(indexFile) == SUCCESS;
+
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < licenses && correct; i++) {
+        license_id id = random();
+        time_t deadline = now + (time_t)(random() % (365 * 24 * 60 * 60));
+        deadlines[id] = deadline;
+        ids.push_back(id);
+        correct = index.UpsertLicense(id, deadline) == SUCCESS;
+    }
+    double upsertSeconds = duration<double>(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+    correct = correct && index.Compact() == SUCCESS;
+    double compactSeconds = duration<double>(steady_clock::now() - start).count();
+
+    if (!correct) {
+        cout << "Fail to build the deadline index." << endl;
+        return -1;
+    }
+    cout << "indexed " << licenses << " licenses: " << fixed << setprecision(0) << licenses / upsertSeconds << " upserts/sec, compacted in "
+         << setprecision(2) << compactSeconds << " seconds" << endl;
+
+    correct = RunQueries(index, deadlines, "compacted");
+
+    // renew (or remove) a share of the licenses, which are kept in the journal until the next compaction.
+    for (int i = 0; i < renewals; i++) {
+        license_id id = ids[random() % ids.size()];
+        if (i % 10 == 0) {
+            index.RemoveLicense(id);
+            deadlines[id] = 0;
+        } else {
+            deadlines[id] = now + (time_t)(random() % (30 * 24 * 60 * 60));
+            index.UpsertLicense(id, deadlines[id]);
+        }
+    }
+    correct = RunQueries(index, deadlines, "with journal") && correct;
+
+    // reopening the index replays the journal.
+    LicenseDeadlineIndex reopened;
+    start = steady_clock::now();
+    correct = reopened.Open(indexFile) == SUCCESS && correct;
+    cout << "reopened with " << reopened.GetJournalSize() << " journal records in " << setprecision(3)
+         << duration<double>(steady_clock::now() - start).count() * 1e3 << " ms" << endl;
+    correct = RunQueries(reopened, deadlines, "reopened") && correct;
+
+    unlink(indexFile.c_str());
+    unlink((indexFile + ".journal").c_str());
+    rmdir(dirTemplate);
+
+    return correct ? 0 : 1;
+}
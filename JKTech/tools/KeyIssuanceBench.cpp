@@ -0,0 +1,128 @@
+/**
+ * @file KeyIssuanceBench.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief 
+ * 
+ * A benchmark of the license issuance with the per-license key randomization.
+ * 
+ * It builds a prime pool, then issues licenses (i.e., CreateTimeStampFile) with the default key schedule and with a key schedule drawn from the pool,
+ * and reports the issuance throughput of both. Each license issued with a drawn key schedule is inspected again by another operation given the same pool
+ * (which looks up the key schedule from the indexes kept in the checksum file) to make sure it can be decrypted, and by one without the pool to make sure it cannot.
+ * 
+ * Usage: KeyIssuanceBench [number of primes (default 1048576)] [bits of each prime (default 64)] [number of licenses (default 2000)]
+ * 
+ * @version 0.1
+ * @date 2022-03-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../include/LicenseTimeStamp.h"
+#include "../include/LicensePrimePool.h"
+#include "ToolConsole.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const double LicenseDuration = 30;
+
+int main(int argc, char *argv[])
+{
+    size_t primeCount = argc > 1 ? strtoull(argv[1], nullptr, 10) : (1 << 20);
+    int primeBits = argc > 2 ? atoi(argv[2]) : 64;
+    int licenses = argc > 3 ? atoi(argv[3]) : 2000;
+
+    if (licenses < 1) {
+        cout << "Usage: " << argv[0] << " [number of primes] [bits of each prime] [number of licenses]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/KeyIssuanceBench.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string poolFile = string(dirTemplate) + "/primes.bin";
+    string encryptedFile = string(dirTemplate) + "/Encrypted.txt";
+    string checksumFile = string(dirTemplate) + "/checksum.txt";
+
+    steady_clock::time_point start = steady_clock::now();
+    OperationState result = LicensePrimePool::BuildPrimePoolFile(poolFile, primeCount, primeBits);
+    double buildSeconds = duration<double>(steady_clock::now() - start).count();
+
+    LicensePrimePool pool;
+    if (result != SUCCESS || (result = pool.LoadPrimePoolFile(poolFile)) != SUCCESS) {
+        cout << "Fail to prepare the prime pool. error: " << result << endl;
+        return -1;
+    }
+    cout << "prime pool: " << pool.GetPrimeCount() << " " << pool.GetPrimeBits() << "-bit primes, built offline in " << fixed << setprecision(2) << buildSeconds << " seconds" << endl;
+
+    MutedConsole console;
+
+    double encryptedOut[SIZE];
+    string checksum;
+    int failures = 0;
+
+    start = steady_clock::now();
+    for (int i = 0; i < licenses; i++) {
+        LicenseTimeStampOperation issuer(encryptedFile, checksumFile, LicenseDuration);
+        failures += issuer.CreateTimeStampFile(encryptedOut, checksum) != SUCCESS ? 1 : 0;
+        unlink(encryptedFile.c_str());
+        unlink(checksumFile.c_str());
+    }
+    double defaultSeconds = duration<double>(steady_clock::now() - start).count();
+
+    double issueSeconds = 0;
+    int undecryptable = 0;
+
+    for (int i = 0; i < licenses; i++) {
+        start = steady_clock::now();
+        LicenseTimeStampOperation issuer(encryptedFile, checksumFile, LicenseDuration, prime_list(), &pool);
+        failures += issuer.CreateTimeStampFile(encryptedOut, checksum) != SUCCESS ? 1 : 0;
+        issueSeconds += duration<double>(steady_clock::now() - start).count();
+
+        // the key schedule is looked up again from the indexes kept in the checksum file, as it is when the license is inspected.
+        time_t startTime, deadline;
+        LicenseTimeStampOperation inspector(encryptedFile, checksumFile, LicenseDuration, prime_list(), &pool);
+        if (inspector.GetExpiryDeadline(startTime, deadline) != SUCCESS || llabs((long long)(time(nullptr) - startTime)) > 60) {
+            undecryptable++;
+        }
+        LicenseTimeStampOperation withoutPool(encryptedFile, checksumFile, LicenseDuration);
+        if (withoutPool.GetExpiryDeadline(startTime, deadline) != TIMESTAMP_RETRIEVAL_ERROR) {
+            undecryptable++;
+        }
+
+        unlink(encryptedFile.c_str());
+        unlink(checksumFile.c_str());
+    }
+
+    // the draws alone, i.e., the part of the issuance spent in the prime pool.
+    vector<uint32_t> indexes;
+    prime_list schedule;
+    start = steady_clock::now();
+    for (int i = 0; i < licenses; i++) {
+        pool.DrawKeySchedule(indexes, schedule);
+    }
+    double drawSeconds = duration<double>(steady_clock::now() - start).count();
+
+    console.Restore();
+
+    unlink(poolFile.c_str());
+    rmdir(dirTemplate);
+
+    double defaultRate = licenses / defaultSeconds;
+    double pooledRate = licenses / issueSeconds;
+    cout << "default key schedule:  " << setprecision(0) << defaultRate << " licenses/sec" << endl;
+    cout << "drawn key schedule:    " << pooledRate << " licenses/sec (" << setprecision(2) << drawSeconds * 1e6 / licenses << " us per draw), "
+         << defaultRate / pooledRate << "x slower" << endl;
+    cout << "failed issuances: " << failures << ", undecryptable licenses: " << undecryptable << endl;
+
+    return failures + undecryptable > 0 ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file LicenseAudit.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief 
+ * 
+ * The console program of the audit pipeline (see LicenseAuditPipeline). It discovers and verifies all license pairs under the given directories,
+ * streams the results as CSV or JSON lines, and reports the throughput (files/sec) when it completes. The licenses issued from a prime pool are verified with the pool file given by -p.
+ * 
+ * Usage: LicenseAudit [-f csv|json] [-o output file] [-t threads] [-d license duration in days] [-r revocation file] [-p prime pool file] <directory> [<directory> ...]
+ * 
+ * @version 0.1
+ * @date 2022-03-01
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/LicenseAuditPipeline.h"
+#include "../include/LicenseRevocationList.h"
+#include "../include/LicensePrimePool.h"
+#include "ToolConsole.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    AuditOutputFormat format = AUDIT_CSV;
+    string outputFile = "/dev/stdout";
+    int threads = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+    double licenseDuration = 30;
+    string revocationFile = "";
+    string poolFile = "";
+    int option;
+
+    while ((option = getopt(argc, argv, "f:o:t:d:r:p:")) != -1) {
+        switch (option) {
+            case 'f':
+                format = strcmp(optarg, "json") == 0 ? AUDIT_JSON : AUDIT_CSV;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'd':
+                licenseDuration = atof(optarg);
+                break;
+            case 'r':
+                revocationFile = optarg;
+                break;
+            case 'p':
+                poolFile = optarg;
+                break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-f csv|json] [-o output file] [-t threads] [-d license duration in days] [-r revocation file] [-p prime pool file] <directory> [<directory> ...]" << endl;
+                return -1;
+        }
+    }
+
+    vector<string> directories(argv + optind, argv + argc);
+    if (directories.empty()) {
+        cerr << "Usage: " << argv[0] << " [-f csv|json] [-o output file] [-t threads] [-d license duration in days] [-r revocation file] [-p prime pool file] <directory> [<directory> ...]" << endl;
+        return -1;
+    }
+
+    ofstream output(outputFile);
+    if (!output.is_open()) {
+        cerr << "Unable to open file, " << outputFile << endl;
+        return -1;
+    }
+
+    MutedConsole console;
+
+    LicenseRevocationList revocationList;
+    LicensePrimePool pool;
+    LicenseAuditPipeline pipeline(licenseDuration, threads);
+    OperationState result = SUCCESS;
+
+    if (!revocationFile.empty()) {
+        if ((result = revocationList.LoadRevocationFile(revocationFile)) != SUCCESS) {
+            console.Restore();
+            cerr << "Fail to load the revocation file. error: " << result << endl;
+            return -1;
+        }
+        pipeline.SetRevocationList(&revocationList);
+    }
+    if (!poolFile.empty()) {
+        if ((result = pool.LoadPrimePoolFile(poolFile)) != SUCCESS) {
+            console.Restore();
+            cerr << "Fail to load the prime pool file. error: " << result << endl;
+            return -1;
+        }
+        pipeline.SetPrimePool(&pool);
+    }
+
+    result = pipeline.Run(directories, output, format);
+    output.close();
+
+    console.Restore();
+
+    if (result != SUCCESS) {
+        cerr << "Fail to audit the license files. error: " << result << endl;
+        return -1;
+    }
+
+    LicenseAuditStatistics statistics = pipeline.GetStatistics();
+    cerr << statistics.DirectoriesScanned << " directories, " << statistics.FilesScanned << " files, " << statistics.PairsVerified << " license pairs ("
+         << statistics.ValidLicenses << " valid, " << statistics.ExpiredLicenses << " expired, " << statistics.FailedLicenses << " failed, "
+         << statistics.OrphanCheckSumFiles << " orphan checksum files) in " << fixed << setprecision(2) << statistics.Seconds << " seconds: "
+         << setprecision(0) << statistics.FilesScanned / statistics.Seconds << " files/sec" << endl;
+
+    return statistics.FailedLicenses > 0 ? 1 : 0;
+}
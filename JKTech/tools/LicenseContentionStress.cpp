@@ -0,0 +1,384 @@
+/**
+ * @file LicenseContentionStress.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A stress and scalability harness for the license files under contention.
+ *
+ * N processes x M threads run a mixed workload of CreateTimeStampFile, InspectTimeStamp and IsTimeStampExpired against the same encrypted timestamp file and checksum file.
+ * Each round starts from no license files, so the processes race to create the license (including the race between the file existence check and the file write in CreateTimeStampFile).
+ *
+ * It reports the throughput, the p50/p99/p999 latency of each operation, and the correctness violations:
+ *  - double creation: more than one CreateTimeStampFile succeeded in the same round
+ *  - torn read: InspectTimeStamp found the files tampered with, failed to open them, or decrypted a malformed timestamp
+ *  - inconsistent read: different timestamps were decrypted in the same round
+ *  - wrong expiry: IsTimeStampExpired found the license expired although both of its files existed before the call (the license is issued for 30 days)
+ *  - lost process: a process crashed, exited with a failure or did not report its counters
+ *
+ * Usage: LicenseContentionStress [processes (default 64)] [threads per process (default 4)] [rounds (default 5)] [operations per thread (default 50)]
+ *
+ * It returns 1 if any correctness violation was found.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "../include/LicenseTimeStamp.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * @brief
+ * The operations in the workload.
+ */
+enum WorkloadOperation {
+    CREATE_OPERATION,
+    INSPECT_OPERATION,
+    EXPIRE_OPERATION,
+    OPERATION_COUNT
+};
+
+const char* WorkloadOperationNames[OPERATION_COUNT] = {"create", "inspect", "expire"};
+
+/**
+ * @brief
+ * The share of each operation in the workload (in percent).
+ */
+const int CREATE_PERCENT = 20;
+const int INSPECT_PERCENT = 40;
+
+/**
+ * @brief
+ * The delay (in milliseconds) before all processes start the workload at the same time.
+ */
+const int START_DELAY_MS = 200;
+
+/**
+ * @brief
+ * The counters reported by each process to the harness.
+ */
+struct ProcessReport {
+    unsigned long Operations[OPERATION_COUNT];
+    unsigned long CreateSucceeded;
+    unsigned long CreateFailed;
+    unsigned long TornReads;
+    unsigned long ValidReads;
+    unsigned long WrongExpiries;
+    unsigned long TimeStampCount;
+};
+
+/**
+ * @brief
+ * A function to write the whole buffer into a pipe.
+ */
+static bool WriteAll(int fd, const void *buffer, size_t length) {
+    const char *p = (const char *)buffer;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * A function to read the whole buffer from a pipe.
+ */
+static bool ReadAll(int fd, void *buffer, size_t length) {
+    char *p = (char *)buffer;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * The workload of a single process. It runs the threads, and writes the report, the distinct timestamps and the latencies into the pipe.
+ */
+static void RunProcess(int fd, int processIndex, int threads, int operations, const string &encryptedFile, const string &checksumFile, steady_clock::time_point start) {
+    ProcessReport report;
+    memset(&report, 0, sizeof(report));
+    vector<uint64_t> latencies[OPERATION_COUNT];
+    set<string> timeStamps;
+    mutex reportMutex;
+    vector<thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&, t]() {
+            mt19937 random(processIndex * 1000 + t);
+            uniform_int_distribution<int> percent(0, 99);
+            vector<uint64_t> local[OPERATION_COUNT];
+            ProcessReport counters;
+            memset(&counters, 0, sizeof(counters));
+            set<string> seen;
+
+            LicenseTimeStampOperation operation(encryptedFile, checksumFile, 30);
+            double encryptedOut[SIZE];
+            string output;
+
+            this_thread::sleep_until(start);
+
+            for (int i = 0; i < operations; i++) {
+                int p = percent(random);
+                WorkloadOperation op = p < CREATE_PERCENT ? CREATE_OPERATION : (p < CREATE_PERCENT + INSPECT_PERCENT ? INSPECT_OPERATION : EXPIRE_OPERATION);
+                steady_clock::time_point begin = steady_clock::now();
+                OperationState result = SUCCESS;
+                bool expired = false;
+                // the files are never removed in a round, so a license whose files both exist before the call has been created and must be valid.
+                bool issued = op == EXPIRE_OPERATION && access(encryptedFile.c_str(), F_OK) == 0 && access(checksumFile.c_str(), F_OK) == 0;
+
+                switch (op) {
+                    case CREATE_OPERATION:
+                        result = operation.CreateTimeStampFile(encryptedOut, output);
+                        break;
+                    case INSPECT_OPERATION:
+                        result = operation.InspectTimeStamp(output);
+                        break;
+                    default:
+                        expired = operation.IsTimeStampExpired();
+                        break;
+                }
+                local[op].push_back(duration_cast<nanoseconds>(steady_clock::now() - begin).count());
+
+                if (op == CREATE_OPERATION) {
+                    if (result == SUCCESS) {
+                        counters.CreateSucceeded++;
+                    } else if (result != FILE_EXIST) {
+                        counters.CreateFailed++;
+                    }
+                } else if (op == INSPECT_OPERATION && result != FILE_NOT_EXIST) {
+                    // the files can be missing before the license is created, but any other failure means that a partially written file was read.
+                    if (result != SUCCESS || !LicenseTimeStampOperation::IsWellFormedTimeStamp(output)) {
+                        counters.TornReads++;
+                    } else {
+                        counters.ValidReads++;
+                        seen.insert(output);
+                    }
+                } else if (op == EXPIRE_OPERATION && issued && expired) {
+                    counters.WrongExpiries++;
+                }
+            }
+
+            lock_guard<mutex> guard(reportMutex);
+            for (int k = 0; k < OPERATION_COUNT; k++) {
+                report.Operations[k] += local[k].size();
+                latencies[k].insert(latencies[k].end(), local[k].begin(), local[k].end());
+            }
+            report.CreateSucceeded += counters.CreateSucceeded;
+            report.CreateFailed += counters.CreateFailed;
+            report.TornReads += counters.TornReads;
+            report.ValidReads += counters.ValidReads;
+            report.WrongExpiries += counters.WrongExpiries;
+            timeStamps.insert(seen.begin(), seen.end());
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    report.TimeStampCount = timeStamps.size();
+    WriteAll(fd, &report, sizeof(report));
+    for (set<string>::iterator it = timeStamps.begin(); it != timeStamps.end(); ++it) {
+        char buffer[TIMESTAMP_LENGTH];
+        memcpy(buffer, it->data(), TIMESTAMP_LENGTH);
+        WriteAll(fd, buffer, TIMESTAMP_LENGTH);
+    }
+    for (int k = 0; k < OPERATION_COUNT; k++) {
+        if (!latencies[k].empty()) {
+            WriteAll(fd, latencies[k].data(), latencies[k].size() * sizeof(uint64_t));
+        }
+    }
+}
+
+/**
+ * @brief
+ * A function to retrieve a percentile (in microseconds) from the sorted latencies (in nanoseconds).
+ */
+static double Percentile(const vector<uint64_t> &sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int processes = argc > 1 ? atoi(argv[1]) : 64;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    int operations = argc > 4 ? atoi(argv[4]) : 50;
+
+    if (processes < 1 || threads < 1 || rounds < 1 || operations < 1) {
+        cout << "Usage: " << argv[0] << " [processes] [threads per process] [rounds] [operations per thread]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/LicenseContentionStress.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string encryptedFile = string(dirTemplate) + "/Encrypted.txt";
+    string checksumFile = string(dirTemplate) + "/checksum.txt";
+
+    cout << processes << " process(es) x " << threads << " thread(s), " << rounds << " round(s), " << operations << " operation(s) per thread" << endl;
+
+    vector<uint64_t> latencies[OPERATION_COUNT];
+    unsigned long totalOperations = 0;
+    unsigned long doubleCreations = 0;
+    unsigned long failedCreations = 0;
+    unsigned long tornReads = 0;
+    unsigned long validReads = 0;
+    unsigned long inconsistentRounds = 0;
+    unsigned long wrongExpiries = 0;
+    unsigned long lostProcesses = 0;
+    double workloadSeconds = 0;
+
+    for (int round = 0; round < rounds; round++) {
+        unlink(encryptedFile.c_str());
+        unlink(checksumFile.c_str());
+
+        steady_clock::time_point start = steady_clock::now() + milliseconds(START_DELAY_MS);
+        vector<pid_t> children;
+        vector<int> pipes;
+
+        cout.flush();
+        for (int p = 0; p < processes; p++) {
+            int fds[2];
+            if (pipe(fds) != 0) {
+                cout << "Unable to create a pipe." << endl;
+                return -1;
+            }
+            pid_t pid = fork();
+            if (pid < 0) {
+                cout << "Unable to fork a process." << endl;
+                return -1;
+            }
+            if (pid == 0) {
+                // the library prints its debug messages to the console, which are discarded in the worker processes.
+                int devNull = open("/dev/null", O_WRONLY);
+                dup2(devNull, STDOUT_FILENO);
+                close(fds[0]);
+                RunProcess(fds[1], p, threads, operations, encryptedFile, checksumFile, start);
+                close(fds[1]);
+                _exit(0);
+            }
+            close(fds[1]);
+            children.push_back(pid);
+            pipes.push_back(fds[0]);
+        }
+
+        unsigned long created = 0;
+        set<string> timeStamps;
+        vector<bool> reported(processes, true);
+
+        for (int p = 0; p < processes; p++) {
+            ProcessReport report;
+            if (!ReadAll(pipes[p], &report, sizeof(report))) {
+                cout << "Process " << children[p] << " did not report." << endl;
+                reported[p] = false;
+                close(pipes[p]);
+                continue;
+            }
+            for (unsigned long i = 0; i < report.TimeStampCount; i++) {
+                char buffer[TIMESTAMP_LENGTH];
+                if (!ReadAll(pipes[p], buffer, TIMESTAMP_LENGTH)) {
+                    reported[p] = false;
+                    break;
+                }
+                timeStamps.insert(string(buffer, TIMESTAMP_LENGTH));
+            }
+            for (int k = 0; k < OPERATION_COUNT; k++) {
+                size_t offset = latencies[k].size();
+                latencies[k].resize(offset + report.Operations[k]);
+                if (report.Operations[k] > 0 && (!reported[p] || !ReadAll(pipes[p], &latencies[k][offset], report.Operations[k] * sizeof(uint64_t)))) {
+                    latencies[k].resize(offset);
+                    reported[p] = false;
+                    continue;
+                }
+                totalOperations += report.Operations[k];
+            }
+            if (!reported[p]) {
+                cout << "Process " << children[p] << " did not report its timestamps and latencies." << endl;
+            }
+            created += report.CreateSucceeded;
+            failedCreations += report.CreateFailed;
+            tornReads += report.TornReads;
+            validReads += report.ValidReads;
+            wrongExpiries += report.WrongExpiries;
+            close(pipes[p]);
+        }
+        for (int p = 0; p < processes; p++) {
+            int status = 0;
+            if (waitpid(children[p], &status, 0) != children[p] || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                cout << "Process " << children[p] << " exited abnormally." << endl;
+                reported[p] = false;
+            }
+            if (!reported[p]) {
+                lostProcesses++;
+            }
+        }
+        workloadSeconds += duration<double>(steady_clock::now() - start).count();
+
+        if (created > 1) {
+            doubleCreations += created - 1;
+        }
+        if (timeStamps.size() > 1) {
+            inconsistentRounds++;
+        }
+        cout << "round " << round + 1 << ": " << created << " creation(s), " << timeStamps.size() << " distinct timestamp(s)" << endl;
+    }
+
+    unlink(encryptedFile.c_str());
+    unlink(checksumFile.c_str());
+    rmdir(dirTemplate);
+
+    cout << endl << "throughput: " << fixed << setprecision(0) << totalOperations / workloadSeconds << " operations/sec" << endl;
+    cout << setw(10) << "operation" << setw(10) << "count" << setw(12) << "p50(us)" << setw(12) << "p99(us)" << setw(12) << "p999(us)" << setw(12) << "max(us)" << endl;
+    for (int k = 0; k < OPERATION_COUNT; k++) {
+        sort(latencies[k].begin(), latencies[k].end());
+        cout << setw(10) << WorkloadOperationNames[k] << setw(10) << latencies[k].size() << setprecision(1)
+             << setw(12) << Percentile(latencies[k], 0.5) << setw(12) << Percentile(latencies[k], 0.99)
+             << setw(12) << Percentile(latencies[k], 0.999) << setw(12) << Percentile(latencies[k], 1.0) << endl;
+    }
+
+    cout << endl << "correctness violations:" << endl;
+    cout << "  double creations:   " << doubleCreations << endl;
+    cout << "  failed creations:   " << failedCreations << endl;
+    cout << "  torn reads:         " << tornReads << " (of " << tornReads + validReads << " reads)" << endl;
+    cout << "  inconsistent rounds: " << inconsistentRounds << endl;
+    cout << "  wrong expiries:     " << wrongExpiries << endl;
+    cout << "  lost processes:     " << lostProcesses << endl;
+
+    return doubleCreations + failedCreations + tornReads + inconsistentRounds + wrongExpiries + lostProcesses > 0 ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file LicenseMigrate.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * The console program of the migration engine (see LicenseMigrationEngine). It re-encrypts all license pairs under the given directories from the source key schedule
+ * to the target key schedule, and reports the progress, the throughput and the peak memory usage once per second.
+ *
+ * A key schedule file has one prime pair "p q" per line. Without a key schedule file, the default key schedule is used.
+ * The licenses issued with a key schedule drawn from a prime pool are decrypted with the source prime pool file, and with a target prime pool file,
+ * each license is re-encrypted with a key schedule drawn for it (instead of the target key schedule).
+ * An interrupted migration is resumed by running the same command again (i.e., with the same journal file and the same directories).
+ *
+ * Usage: LicenseMigrate -j journal file [-s source key schedule file] [-k target key schedule file] [-p source prime pool file] [-P target prime pool file] [-t threads per stage] [-q queue capacity] <directory> [<directory> ...]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/LicenseMigrationEngine.h"
+#include "../include/LicensePrimePool.h"
+#include "ToolConsole.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * A function to read a key schedule file, i.e., one prime pair "p q" per line.
+ */
+static bool ReadKeySchedule(const string &fileName, prime_list &schedule)
+{
+    schedule.clear();
+    if (fileName.empty()) {
+        return true;
+    }
+
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        return false;
+    }
+    for (uint64_t p, q; file >> p >> q;) {
+        schedule.push_back(tuple<uint64_t, uint64_t>(p, q));
+    }
+    return !schedule.empty() && file.eof();
+}
+
+int main(int argc, char *argv[])
+{
+    string journalFile = "";
+    string sourceFile = "";
+    string targetFile = "";
+    string sourcePoolFile = "";
+    string targetPoolFile = "";
+    int threads = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+    size_t queueCapacity = DEFAULT_MIGRATION_QUEUE_CAPACITY;
+    int option;
+
+    while ((option = getopt(argc, argv, "j:s:k:p:P:t:q:")) != -1) {
+        switch (option) {
+            case 'j':
+                journalFile = optarg;
+                break;
+            case 's':
+                sourceFile = optarg;
+                break;
+            case 'k':
+                targetFile = optarg;
+                break;
+            case 'p':
+                sourcePoolFile = optarg;
+                break;
+            case 'P':
+                targetPoolFile = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'q':
+                queueCapacity = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                journalFile = "";
+                optind = argc;
+                break;
+        }
+    }
+
+    vector<string> directories(argv + optind, argv + argc);
+    if (journalFile.empty() || directories.empty()) {
+        cerr << "Usage: " << argv[0] << " -j journal file [-s source key schedule file] [-k target key schedule file] [-p source prime pool file] [-P target prime pool file] [-t threads per stage] [-q queue capacity] <directory> [<directory> ...]" << endl;
+        return -1;
+    }
+
+    prime_list sourceSchedule;
+    prime_list targetSchedule;
+    if (!ReadKeySchedule(sourceFile, sourceSchedule) || !ReadKeySchedule(targetFile, targetSchedule)) {
+        cerr << "Unable to read the key schedule files." << endl;
+        return -1;
+    }
+
+    MutedConsole console;
+
+    LicensePrimePool sourcePool;
+    LicensePrimePool targetPool;
+    if ((!sourcePoolFile.empty() && sourcePool.LoadPrimePoolFile(sourcePoolFile) != SUCCESS) ||
+        (!targetPoolFile.empty() && targetPool.LoadPrimePoolFile(targetPoolFile) != SUCCESS)) {
+        console.Restore();
+        cerr << "Unable to load the prime pool files." << endl;
+        return -1;
+    }
+
+    // the progress is reported to the standard error, as the console is muted.
+    key_schedule_lookup sourceLookup = [&sourceSchedule](const string &, license_id, prime_list &schedule) { schedule = sourceSchedule; return SUCCESS; };
+    LicenseMigrationEngine engine(sourceLookup, sourcePoolFile.empty() ? nullptr : &sourcePool, targetSchedule, targetPoolFile.empty() ? nullptr : &targetPool,
+                                  threads, queueCapacity);
+    OperationState result = engine.Run(directories, journalFile, &cerr);
+
+    console.Restore();
+
+    if (result != SUCCESS) {
+        cerr << "Fail to migrate the license files. error: " << result << endl;
+        return -1;
+    }
+
+    LicenseMigrationStatistics statistics = engine.GetStatistics();
+    cerr << statistics.PairsDiscovered << " license pairs (" << statistics.PairsMigrated << " migrated, " << statistics.PairsSkipped << " already migrated, "
+         << statistics.PairsResumed << " resumed, " << statistics.PairsFailed << " failed) in " << fixed << setprecision(2) << statistics.Seconds << " seconds: "
+         << setprecision(0) << statistics.PairsMigrated / statistics.Seconds << " licenses/sec, peak RSS " << setprecision(1)
+         << statistics.PeakResidentKiloBytes / 1024.0 << " MB" << endl;
+
+    return statistics.PairsFailed > 0 ? 1 : 0;
+}
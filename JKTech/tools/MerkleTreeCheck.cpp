@@ -0,0 +1,205 @@
+/**
+ * @file MerkleTreeCheck.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A self-check of the Merkle tree integrity index.
+ *
+ * For each number of license records up to the given maximum, and each number of threads up to the given maximum, it builds the tree from license files
+ * and checks the root against a naive level-by-level computation, every proof, the appended and updated records, the index file and root file round trip,
+ * the rejection of a corrupted index file, and the detection of a tampered record.
+ *
+ * Usage: MerkleTreeCheck [maximal number of records (default 39)] [maximal number of threads (default 8)]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/LicenseMerkleTree.h"
+#include "ToolConsole.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * A function to compute the root of the records naively, one level after another (a node without a right sibling is promoted as it is).
+ */
+static license_digest NaiveRoot(const vector<string> &records)
+{
+    if (records.empty()) {
+        return ComputeDigest("", 0, 0x00);
+    }
+
+    vector<license_digest> level;
+    for (size_t i = 0; i < records.size(); i++) {
+        level.push_back(ComputeDigest(records[i].data(), records[i].length(), 0x00));
+    }
+    while (level.size() > 1) {
+        vector<license_digest> upper;
+        for (size_t i = 0; i < level.size(); i += 2) {
+            upper.push_back(i + 1 < level.size() ? ComputeDigest(level[i], level[i + 1], 0x01) : level[i]);
+        }
+        level.swap(upper);
+    }
+    return level[0];
+}
+
+/**
+ * @brief
+ * A function to write a file with the given content.
+ */
+static bool WriteFile(const string &name, const string &content)
+{
+    ofstream file(name, ios::binary | ios::trunc);
+    file << content;
+    file.close();
+    return !file.fail();
+}
+
+/**
+ * @brief
+ * A function to read a whole file.
+ */
+static string ReadFile(const string &name)
+{
+    ifstream file(name, ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+/**
+ * @brief
+ * A function to check that every record has a valid proof, and that a proof does not hold for another record or another index.
+ */
+static bool CheckProofs(const LicenseMerkleTree &tree, const vector<string> &records)
+{
+    license_digest root = tree.GetRoot();
+
+    for (size_t i = 0; i < records.size(); i++) {
+        vector<license_digest> proof;
+        if (tree.GetProof(i, proof) != SUCCESS || !LicenseMerkleTree::VerifyProof(records[i], i, records.size(), proof, root)) {
+            return false;
+        }
+        if (LicenseMerkleTree::VerifyProof(records[i] + "x", i, records.size(), proof, root)) {
+            return false;
+        }
+        if (records.size() > 1 && LicenseMerkleTree::VerifyProof(records[i], (i + 1) % records.size(), records.size(), proof, root)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int maxRecords = argc > 1 ? atoi(argv[1]) : 39;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+
+    if (maxRecords < 1 || maxThreads < 1) {
+        cout << "Usage: " << argv[0] << " [maximal number of records] [maximal number of threads]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/MerkleTreeCheck.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string root = dirTemplate;
+    string indexFile = root + "/licenses.index";
+    string rootFile = root + "/licenses.root";
+    string corruptedFile = root + "/corrupted.index";
+
+    MutedConsole console;
+
+    license_file_list files;
+    int failures = 0;
+    int checks = 0;
+
+    for (int n = 1; n <= maxRecords; n++) {
+        string name = root + "/" + to_string(n - 1);
+        files.push_back(make_tuple(name + "Encrypted.txt", name + "checksum.txt"));
+        WriteFile(get<0>(files.back()), "encrypted timestamp " + to_string(n - 1) + "\n");
+        WriteFile(get<1>(files.back()), "checksum " + to_string((n - 1) * 7919) + "\n");
+
+        vector<string> records(n);
+        for (int i = 0; i < n; i++) {
+            LicenseMerkleTree::ReadLicenseRecord(get<0>(files[i]), get<1>(files[i]), records[i]);
+        }
+        license_digest expected = NaiveRoot(records);
+
+        // the tree built incrementally is the same as the one built at once.
+        LicenseMerkleTree appended;
+        for (int i = 0; i < n; i++) {
+            appended.AppendRecord(records[i]);
+        }
+        bool appendedCorrect = appended.GetRoot() == expected && appended.GetRecordCount() == (size_t)n;
+
+        for (int threads = 1; threads <= maxThreads; threads++) {
+            bool correct = appendedCorrect;
+            LicenseMerkleTree tree;
+            vector<size_t> tampered;
+            correct = tree.BuildFromFiles(files, threads) == SUCCESS && tree.GetRoot() == expected && correct;
+            correct = CheckProofs(tree, records) && tree.VerifyFiles(files, tampered, threads) == SUCCESS && tampered.empty() && correct;
+
+            // the index file and the root file are written atomically, and the tree loaded from them matches the root file.
+            LicenseMerkleTree loaded;
+            correct = tree.WriteIndexFile(indexFile) == SUCCESS && tree.WriteRootFile(rootFile) == SUCCESS && correct;
+            correct = access((indexFile + STAGED_FILE_SUFFIX).c_str(), F_OK) != 0 && access((rootFile + STAGED_FILE_SUFFIX).c_str(), F_OK) != 0 && correct;
+            correct = loaded.LoadIndexFile(indexFile, threads) == SUCCESS && loaded.VerifyRootFile(rootFile) == SUCCESS && loaded.GetRoot() == expected && correct;
+
+            // a truncated index file, or one whose leaf count does not match its size, is rejected without allocating the leaves.
+            string index = ReadFile(indexFile);
+            string corrupted = index;
+            uint64_t hugeCount = (uint64_t)1 << 60;
+            corrupted.replace(sizeof(uint32_t) + sizeof(uint32_t), sizeof(hugeCount), (const char *)&hugeCount, sizeof(hugeCount));
+            LicenseMerkleTree rejected;
+            correct = WriteFile(corruptedFile, index.substr(0, index.length() - 1)) && rejected.LoadIndexFile(corruptedFile, threads) == INTEGRITY_ROOT_MISMATCH && correct;
+            correct = WriteFile(corruptedFile, corrupted) && rejected.LoadIndexFile(corruptedFile, threads) == INTEGRITY_ROOT_MISMATCH && correct;
+
+            // an updated record only changes its path to the root.
+            int updated = (n * 7 + threads) % n;
+            vector<string> updatedRecords(records);
+            updatedRecords[updated] += "renewed";
+            correct = tree.UpdateRecord(updated, updatedRecords[updated]) == SUCCESS && tree.GetRoot() == NaiveRoot(updatedRecords) && correct;
+            correct = CheckProofs(tree, updatedRecords) && tree.VerifyRootFile(rootFile) == INTEGRITY_ROOT_MISMATCH && correct;
+
+            // a tampered record is reported by its index, and only that one.
+            correct = loaded.VerifyFiles(files, tampered, threads) == SUCCESS && correct;
+            string checksum = get<1>(files[updated]);
+            if (rename(checksum.c_str(), (checksum + ".bak").c_str()) == 0) {
+                WriteFile(checksum, "tampered\n");
+                correct = loaded.VerifyFiles(files, tampered, threads) == TIMESTAMP_TAMPERED && tampered.size() == 1 && tampered[0] == (size_t)updated && correct;
+                rename((checksum + ".bak").c_str(), checksum.c_str());
+            } else {
+                correct = false;
+            }
+
+            checks++;
+            if (!correct) {
+                failures++;
+                console.Restore();
+                cout << "MISMATCH: " << n << " records, " << threads << " threads" << endl;
+                console.Mute();
+            }
+        }
+    }
+
+    console.Restore();
+
+    cout << "checked " << maxRecords << " tree sizes with up to " << maxThreads << " threads: " << checks - failures << " of " << checks << " passed" << endl;
+
+    string command = "rm -rf " + root;
+    if (system(command.c_str()) != 0) {
+        cout << "Unable to remove the working directory, " << root << endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
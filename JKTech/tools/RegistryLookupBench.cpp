@@ -0,0 +1,160 @@
+/**
+ * @file RegistryLookupBench.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A benchmark of the compact license registry.
+ *
+ * It inserts the given number of licenses (one in ten of which has expired), reports the memory per license and whether the arena is backed by huge pages,
+ * then reports the expiry checks per second, one at a time and in batches, of licenses in the registry and of licenses which are not.
+ *
+ * Usage: RegistryLookupBench [number of licenses (default 10000000)] [number of lookups (default 20000000)]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/LicenseRegistry.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const size_t BatchSize = 4096;
+
+/**
+ * @brief
+ * A function to generate the identity of the i-th license (the splitmix64 generator), so that the identities do not need to be kept by the benchmark.
+ */
+static license_id LicenseIdentity(uint64_t i)
+{
+    uint64_t x = i * 0x9e3779b97f4a7c15ULL + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief
+ * A function to read the transparent huge pages of the process (in kilobytes) from /proc/self/smaps_rollup.
+ */
+static long AnonHugePagesKiloBytes()
+{
+    ifstream smaps("/proc/self/smaps_rollup");
+    string field;
+    long value;
+
+    while (smaps >> field) {
+        if (field == "AnonHugePages:" && smaps >> value) {
+            return value;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief
+ * A function to time the expiry checks of random licenses, and check the number of expired licenses found.
+ *
+ * @param registry
+ * The registry to look up
+ * @param licenses
+ * The number of licenses in the registry
+ * @param lookups
+ * The number of lookups
+ * @param present
+ * Whether the licenses looked up are in the registry (i.e., the identities 0 .. licenses - 1), or not
+ * @param batched
+ * Whether the licenses are checked in batches, or one at a time
+ */
+static bool RunLookups(const LicenseRegistry &registry, size_t licenses, size_t lookups, bool present, bool batched)
+{
+    mt19937_64 random(20220301);
+    time_t now = time(nullptr);
+    license_id ids[BatchSize];
+    uint64_t indexes[BatchSize];
+    bool expired[BatchSize];
+    size_t expectedExpired = 0;
+    size_t foundExpired = 0;
+    double seconds = 0;
+
+    for (size_t done = 0; done < lookups; done += BatchSize) {
+        size_t count = lookups - done < BatchSize ? lookups - done : BatchSize;
+        for (size_t i = 0; i < count; i++) {
+            indexes[i] = present ? random() % licenses : licenses + random() % licenses;
+            ids[i] = LicenseIdentity(indexes[i]);
+        }
+
+        steady_clock::time_point start = steady_clock::now();
+        if (batched) {
+            registry.IsExpired(ids, count, now, expired);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                expired[i] = registry.IsExpired(ids[i], now);
+            }
+        }
+        seconds += duration<double>(steady_clock::now() - start).count();
+
+        for (size_t i = 0; i < count; i++) {
+            expectedExpired += !present || indexes[i] % 10 == 0 ? 1 : 0;
+            foundExpired += expired[i] ? 1 : 0;
+        }
+    }
+
+    bool correct = expectedExpired == foundExpired;
+    cout << (present ? "registered" : "unknown   ") << " licenses, " << (batched ? "batched:   " : "one by one:") << " "
+         << fixed << setprecision(1) << lookups / seconds / 1e6 << " M lookups/sec, " << setprecision(1) << seconds * 1e9 / lookups << " ns per lookup"
+         << (correct ? "" : " (MISMATCH)") << endl;
+    return correct;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t licenses = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t lookups = argc > 2 ? strtoull(argv[2], nullptr, 10) : 20000000;
+
+    if (licenses < 1 || lookups < 1) {
+        cout << "Usage: " << argv[0] << " [number of licenses] [number of lookups]" << endl;
+        return -1;
+    }
+
+    time_t now = time(nullptr);
+    LicenseRegistry registry;
+    bool correct = registry.Reserve(licenses) == SUCCESS;
+
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < licenses && correct; i++) {
+        // one in ten of the licenses has expired an hour ago, the others expire in 30 days.
+        time_t deadline = i % 10 == 0 ? now - 3600 : now + 30 * 24 * 3600;
+        correct = registry.Insert(LicenseIdentity(i), deadline, REGISTRY_STATUS_VERIFIED) == SUCCESS;
+    }
+    double insertSeconds = duration<double>(steady_clock::now() - start).count();
+
+    if (!correct || registry.GetCount() != licenses) {
+        cout << "Fail to build the license registry." << endl;
+        return -1;
+    }
+
+    cout << "registered " << licenses << " licenses in " << fixed << setprecision(2) << insertSeconds << " seconds ("
+         << setprecision(1) << licenses / insertSeconds / 1e6 << " M inserts/sec)" << endl;
+    cout << "memory: " << setprecision(1) << registry.GetMemoryBytes() / 1048576.0 << " MB, " << setprecision(2) << registry.GetBytesPerLicense()
+         << " bytes per license (" << sizeof(RegistryRecord) << "-byte records, load factor " << (double)registry.GetCount() / registry.GetCapacity() << ")" << endl;
+    cout << "arena: " << (registry.IsHugePageBacked() ? "reserved huge pages (MAP_HUGETLB)" : "transparent huge pages advised (MADV_HUGEPAGE)")
+         << ", " << AnonHugePagesKiloBytes() / 1024 << " MB of transparent huge pages in the process" << endl;
+
+    correct = RunLookups(registry, licenses, lookups, true, false) && correct;
+    correct = RunLookups(registry, licenses, lookups, true, true) && correct;
+    correct = RunLookups(registry, licenses, lookups, false, false) && correct;
+    correct = RunLookups(registry, licenses, lookups, false, true) && correct;
+
+    return correct ? 0 : 1;
+}
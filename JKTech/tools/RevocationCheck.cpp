@@ -0,0 +1,231 @@
+/**
+ * @file RevocationCheck.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A self-check of the license serials and the revocation list.
+ *
+ * It issues the given number of licenses, revokes some of them, and checks that exactly the revoked licenses are reported as expired. Then it tampers with
+ * the serial of a revoked license in its checksum file (changed to the serial of another license, changed by a single digit, malformed or removed) and with
+ * its encrypted timestamp file, and checks that the license is reported as tampered with (and expired) rather than valid. A license issued before the serial
+ * was introduced (i.e., without a serial) is checked to be still identified by the digest of its checksum.
+ * The registry is checked to follow the latest verification of a license (a restored license is valid again), and to keep its revocation
+ * when it is verified without a revocation list.
+ *
+ * Usage: RevocationCheck [number of licenses (default 16)]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/LicenseTimeStamp.h"
+#include "../include/LicenseDigest.h"
+#include "../include/LicenseRevocationList.h"
+#include "../include/LicenseRegistry.h"
+#include "ToolConsole.h"
+
+using namespace std;
+
+/**
+ * @brief
+ * A function to read the lines of a file.
+ */
+static vector<string> ReadLines(const string &name)
+{
+    vector<string> lines;
+    ifstream file(name);
+    for (string line; getline(file, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * @brief
+ * A function to write the given lines into a file.
+ */
+static bool WriteLines(const string &name, const vector<string> &lines)
+{
+    ofstream file(name, ios::trunc);
+    for (size_t i = 0; i < lines.size(); i++) {
+        file << lines[i] << endl;
+    }
+    file.close();
+    return !file.fail();
+}
+
+/**
+ * @brief
+ * A function to compute the checksum of a license issued before the serial was introduced, i.e., the checksum number of each encrypted byte alone.
+ */
+static string LegacyCheckSum(const string &encryptedFile)
+{
+    ifstream file(encryptedFile);
+    string checksum;
+    for (double value; file >> value;) {
+        checksum += to_string((long int)ceil(fmod(value, CHECKSUM_SIZE)));
+    }
+    return checksum;
+}
+
+int main(int argc, char *argv[])
+{
+    int licenses = argc > 1 ? atoi(argv[1]) : 16;
+
+    if (licenses < 4) {
+        cout << "Usage: " << argv[0] << " [number of licenses (at least 4)]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/RevocationCheck.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string root = dirTemplate;
+    string revocationFile = root + "/licenses.revoked";
+
+    MutedConsole console;
+
+    vector<string> encryptedFiles, checksumFiles;
+    vector<license_id> ids;
+    set<license_id> distinct;
+    vector<string> failures;
+    int checks = 0;
+
+    // the check records a failure under its name, so the failed checks are reported once the console is restored.
+    auto check = [&](bool correct, const string &name) {
+        checks++;
+        if (!correct) {
+            failures.push_back(name);
+        }
+    };
+
+    for (int i = 0; i < licenses; i++) {
+        encryptedFiles.push_back(root + "/" + to_string(i) + "Encrypted.txt");
+        checksumFiles.push_back(root + "/" + to_string(i) + "checksum.txt");
+
+        LicenseTimeStampOperation operation(encryptedFiles[i], checksumFiles[i], 30);
+        double encryptedOut[SIZE];
+        string checksum;
+        license_id id = 0;
+        check(operation.CreateTimeStampFile(encryptedOut, checksum) == SUCCESS && operation.GetLicenseId(id) == SUCCESS, "issue license " + to_string(i));
+        ids.push_back(id);
+        distinct.insert(id);
+    }
+    check(distinct.size() == ids.size() && distinct.count(0) == 0, "distinct serials");
+
+    // the first two licenses are revoked.
+    LicenseRevocationList revocationList;
+    check(LicenseRevocationList::WriteRevocationFile(revocationFile, vector<license_id>(ids.begin(), ids.begin() + 2)) == SUCCESS &&
+          revocationList.LoadRevocationFile(revocationFile) == SUCCESS && revocationList.GetRevokedCount() == 2, "revocation file round trip");
+
+    for (int i = 0; i < licenses; i++) {
+        LicenseTimeStampOperation operation(encryptedFiles[i], checksumFiles[i], 30);
+        check(operation.IsTimeStampExpired(revocationList) == (i < 2), "license " + to_string(i) + (i < 2 ? " revoked" : " valid"));
+    }
+
+    // a revoked license stays expired whichever way its serial is tampered with, and its identity is not trusted.
+    vector<string> original = ReadLines(checksumFiles[0]);
+    check(original.size() == 2, "checksum file with a serial");
+
+    if (original.size() == 2) {
+        string flipped = original[1];
+        flipped[flipped.length() - 1] = flipped[flipped.length() - 1] == '0' ? '1' : '0';
+
+        vector< vector<string> > tampered = {
+            {original[0], ReadLines(checksumFiles[licenses - 1])[1]},
+            {original[0], flipped},
+            {original[0], "not-a-serial"},
+            {original[0]},
+        };
+        const char *labels[] = {"serial of another license", "serial changed by one digit", "malformed serial", "serial removed"};
+
+        for (size_t t = 0; t < tampered.size(); t++) {
+            WriteLines(checksumFiles[0], tampered[t]);
+            LicenseTimeStampOperation operation(encryptedFiles[0], checksumFiles[0], 30);
+            license_id id = 0;
+            check(operation.IsTimeStampExpired(revocationList) && operation.GetLicenseId(id) == TIMESTAMP_TAMPERED, string("revoked license with its ") + labels[t]);
+        }
+        WriteLines(checksumFiles[0], original);
+
+        // a tampered encrypted timestamp file does not make the serial trusted either, though it is returned to flag the license.
+        vector<string> encrypted = ReadLines(encryptedFiles[0]);
+        vector<string> changed(encrypted);
+        changed[0] = to_string(atof(changed[0].c_str()) + 1);
+        WriteLines(encryptedFiles[0], changed);
+        {
+            LicenseTimeStampOperation operation(encryptedFiles[0], checksumFiles[0], 30);
+            license_id id = 0;
+            check(operation.IsTimeStampExpired(revocationList) && operation.GetLicenseId(id) == TIMESTAMP_TAMPERED && id == ids[0], "revoked license with its timestamp changed");
+        }
+        WriteLines(encryptedFiles[0], encrypted);
+
+        LicenseTimeStampOperation operation(encryptedFiles[0], checksumFiles[0], 30);
+        license_id id = 0;
+        check(operation.GetLicenseId(id) == SUCCESS && id == ids[0] && operation.IsTimeStampExpired(revocationList), "restored license revoked again");
+
+        // the registry takes the status of the latest verification, but a verification without a revocation list keeps the revocation.
+        LicenseRegistry registry;
+        time_t now = time(nullptr);
+        LicenseTimeStampOperation valid(encryptedFiles[3], checksumFiles[3], 30);
+        check(registry.RegisterLicense(operation, &revocationList) == SUCCESS && registry.IsExpired(ids[0], now) &&
+              registry.RegisterLicense(valid, &revocationList) == SUCCESS && !registry.IsExpired(ids[3], now), "registry of a revoked and a valid license");
+
+        vector<string> checksum = ReadLines(checksumFiles[3]);
+        vector<string> changedCheckSum(checksum);
+        changedCheckSum[0] = "1" + changedCheckSum[0];
+        WriteLines(checksumFiles[3], changedCheckSum);
+        {
+            LicenseTimeStampOperation tamperedOperation(encryptedFiles[3], checksumFiles[3], 30);
+            check(registry.RegisterLicense(tamperedOperation, &revocationList) == TIMESTAMP_TAMPERED && registry.IsExpired(ids[3], now), "registry of a tampered license");
+        }
+        WriteLines(checksumFiles[3], checksum);
+        check(registry.RegisterLicense(valid) == SUCCESS && !registry.IsExpired(ids[3], now), "registry of a restored license");
+        check(registry.RegisterLicense(operation) == SUCCESS && registry.IsExpired(ids[0], now), "registry of a revoked license verified without a revocation list");
+        check(registry.RegisterLicense(operation, &revocationList) == SUCCESS && registry.IsExpired(ids[0], now), "registry of a revoked license verified again");
+    }
+
+    // a license without a serial is identified by the first 8 bytes of the digest of its checksum, and can be revoked as such.
+    string legacyChecksum = LegacyCheckSum(encryptedFiles[2]);
+    WriteLines(checksumFiles[2], {legacyChecksum});
+    {
+        license_digest digest = ComputeDigest(legacyChecksum.data(), legacyChecksum.length());
+        license_id expected = 0;
+        for (int i = 0; i < 8; i++) {
+            expected = (expected << 8) | digest[i];
+        }
+
+        LicenseTimeStampOperation operation(encryptedFiles[2], checksumFiles[2], 30);
+        license_id id = 0;
+        check(operation.GetLicenseId(id) == SUCCESS && id == expected && !operation.IsTimeStampExpired(revocationList), "license without a serial valid");
+
+        LicenseRevocationList legacyRevoked;
+        check(LicenseRevocationList::WriteRevocationFile(revocationFile, {expected}) == SUCCESS && legacyRevoked.LoadRevocationFile(revocationFile) == SUCCESS &&
+              operation.IsTimeStampExpired(legacyRevoked), "license without a serial revoked");
+    }
+
+    console.Restore();
+
+    for (size_t i = 0; i < failures.size(); i++) {
+        cout << "FAILED: " << failures[i] << endl;
+    }
+    cout << "checked the serials and the revocation of " << licenses << " licenses: " << checks - failures.size() << " of " << checks << " passed" << endl;
+
+    string command = "rm -rf " + root;
+    if (system(command.c_str()) != 0) {
+        cout << "Unable to remove the working directory, " << root << endl;
+    }
+
+    return failures.empty() ? 0 : 1;
+}
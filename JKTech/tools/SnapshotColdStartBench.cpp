@@ -0,0 +1,154 @@
+/**
+ * @file SnapshotColdStartBench.cpp
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * A benchmark of the cold start of a service, with and without the verified-state snapshot.
+ *
+ * It issues the given number of licenses, then measures the time from the start until all of them are in a license registry (i.e., ready for the license checks),
+ * with the same number of threads: by verifying every license (the cold start without a snapshot), and by loading the snapshot after a share of the licenses has been touched (their files
+ * change identity but not content) and a few have been issued again (their files change content). The digest file is kept in a directory of its own
+ * (standing for a protected location). A snapshot which was tampered with must be rejected.
+ *
+ * Usage: SnapshotColdStartBench [number of licenses (default 20000)] [number of threads (default: number of cores)]
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../include/LicenseStateSnapshot.h"
+#include "ToolConsole.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const double LicenseDuration = 30;
+const int LicensesPerDirectory = 100;
+
+int main(int argc, char *argv[])
+{
+    int licenses = argc > 1 ? atoi(argv[1]) : 20000;
+    int threads = argc > 2 ? atoi(argv[2]) : (thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1);
+
+    if (licenses < 1 || threads < 1) {
+        cout << "Usage: " << argv[0] << " [number of licenses] [number of threads]" << endl;
+        return -1;
+    }
+
+    char dirTemplate[] = "/tmp/SnapshotColdStartBench.XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+        cout << "Unable to create the working directory." << endl;
+        return -1;
+    }
+    string root = dirTemplate;
+    string snapshotFile = root + "/licenses.snapshot";
+    string protectedDirectory = root + "/protected";
+    string digestFile = protectedDirectory + "/licenses.snapshot.digest";
+    vector<string> names;
+    license_file_list files;
+
+    MutedConsole console;
+
+    mkdir(protectedDirectory.c_str(), 0700);
+
+    double encryptedOut[SIZE];
+    string checksum;
+    for (int i = 0; i < licenses; i++) {
+        string directory = root + "/" + to_string(i / LicensesPerDirectory);
+        if (i % LicensesPerDirectory == 0) {
+            mkdir(directory.c_str(), 0755);
+        }
+        names.push_back(directory + "/" + to_string(i));
+        files.push_back(make_tuple(names[i] + "Encrypted.txt", names[i] + "checksum.txt"));
+        LicenseTimeStampOperation issuer(names[i] + "Encrypted.txt", names[i] + "checksum.txt", LicenseDuration);
+        issuer.CreateTimeStampFile(encryptedOut, checksum);
+    }
+
+    // the cold start without a snapshot verifies every license, with as many threads as the snapshot is loaded with.
+    steady_clock::time_point start = steady_clock::now();
+    LicenseRegistry fullRegistry(licenses);
+    LicenseStateSnapshot fullSnapshot(LicenseDuration, threads);
+    fullSnapshot.AddLicenses(files, fullRegistry);
+    double fullSeconds = duration<double>(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+    bool correct = fullRegistry.GetCount() == (size_t)licenses && fullSnapshot.WriteSnapshotFile(snapshotFile, digestFile) == SUCCESS;
+    double writeSeconds = duration<double>(steady_clock::now() - start).count();
+
+    // one in a hundred licenses is touched, and one in a thousand is issued again.
+    int touched = 0;
+    int reissued = 0;
+    for (int i = 0; i < licenses; i++) {
+        if (i % 1000 == 999) {
+            unlink((names[i] + "Encrypted.txt").c_str());
+            unlink((names[i] + "checksum.txt").c_str());
+            LicenseTimeStampOperation issuer(names[i] + "Encrypted.txt", names[i] + "checksum.txt", LicenseDuration);
+            issuer.CreateTimeStampFile(encryptedOut, checksum);
+            reissued++;
+        } else if (i % 100 == 0) {
+            utimensat(AT_FDCWD, (names[i] + "Encrypted.txt").c_str(), nullptr, 0);
+            touched++;
+        }
+    }
+
+    // the cold start with the snapshot only verifies the licenses which changed.
+    start = steady_clock::now();
+    LicenseRegistry registry(licenses);
+    LicenseStateSnapshot snapshot(LicenseDuration, threads);
+    OperationState result = snapshot.LoadSnapshotFile(snapshotFile, digestFile, registry);
+    double loadSeconds = duration<double>(steady_clock::now() - start).count();
+    LicenseSnapshotStatistics statistics = snapshot.GetStatistics();
+
+    time_t now = time(nullptr);
+    int expired = 0;
+    for (int i = 0; i < licenses; i++) {
+        LicenseTimeStampOperation operation(names[i] + "Encrypted.txt", names[i] + "checksum.txt", LicenseDuration);
+        license_id id;
+        expired += operation.GetLicenseId(id) != SUCCESS || registry.IsExpired(id, now) ? 1 : 0;
+    }
+
+    // a snapshot which was tampered with is rejected as a whole.
+    int fd = open(snapshotFile.c_str(), O_WRONLY);
+    bool rejected = false;
+    if (fd >= 0 && pwrite(fd, "X", 1, 64) == 1) {
+        LicenseRegistry tamperedRegistry;
+        LicenseStateSnapshot tamperedSnapshot(LicenseDuration, threads);
+        rejected = tamperedSnapshot.LoadSnapshotFile(snapshotFile, digestFile, tamperedRegistry) == INTEGRITY_ROOT_MISMATCH && tamperedRegistry.GetCount() == 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    console.Restore();
+
+    correct = correct && result == SUCCESS && rejected && expired == 0 && registry.GetCount() == (size_t)licenses &&
+              statistics.Unchanged == (unsigned long)(licenses - touched - reissued) && statistics.Rehashed == (unsigned long)touched &&
+              statistics.Reverified == (unsigned long)reissued;
+
+    cout << "cold start, full verification: " << fixed << setprecision(3) << fullSeconds << " seconds for " << licenses << " licenses with " << threads << " thread(s)" << endl;
+    cout << "snapshot written in " << writeSeconds << " seconds" << endl;
+    cout << "cold start, from the snapshot: " << loadSeconds << " seconds (" << setprecision(1) << fullSeconds / loadSeconds << "x faster, "
+         << statistics.Unchanged << " unchanged, " << statistics.Rehashed << " rehashed, " << statistics.Reverified << " reverified, "
+         << statistics.Missing << " missing)" << endl;
+    cout << "tampered snapshot " << (rejected ? "rejected" : "NOT rejected") << ", " << registry.GetCount() << " licenses restored, " << expired
+         << " licenses expired after the restore" << endl;
+
+    string command = "rm -rf " + root;
+    if (system(command.c_str()) != 0) {
+        cout << "Unable to remove the working directory, " << root << endl;
+    }
+
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file ToolConsole.h
+ * @author Hailun Tan (hailun.tan@gmail.com)
+ * @brief
+ *
+ * The console shared by the benchmark and tool programs.
+ *
+ * @version 0.1
+ * @date 2022-03-01
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef __ToolConsole_H__
+#define __ToolConsole_H__
+
+#include <iostream>
+#include <fstream>
+
+using namespace std;
+
+/**
+ * @brief
+ * The library prints its debug messages to the console (see DEBUG), which would be mixed with the results of a tool. A muted console discards them
+ * from its construction on, and the tool restores the console to print its own results. The console is restored when the muted console is destroyed.
+ */
+class MutedConsole
+{
+public:
+
+    MutedConsole() : Console(cout.rdbuf(NullStream.rdbuf())) {}
+    ~MutedConsole() { Restore(); }
+
+    void Mute() { cout.rdbuf(NullStream.rdbuf()); }
+    void Restore() { cout.rdbuf(Console); }
+
+private:
+    MutedConsole(const MutedConsole &);
+    MutedConsole &operator=(const MutedConsole &);
+
+    // the null stream is declared first, so it is open before the console is redirected to it.
+    ofstream NullStream;
+    streambuf *Console;
+};
+
+#endif